@@ -0,0 +1,230 @@
+#include "util/memorytracker.hpp"
+#include "util/timer.hpp"
+#include "voxeloctree.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+// Benchmarks octree construction and the point queries of the noise scene
+// over a range of depths and noise thresholds. Writes JSON with a fixed
+// schema, see writeResult, so runs can be diffed over time.
+//   corebench [--depths min max] [--thresholds t...] [--queries n]
+//             [--out file.json]
+// The default depths 5 to 7 run in seconds. Every level multiplies the
+// generation time by about 8, so deeper trees are opt-in with --depths.
+
+namespace
+{
+const char* SCHEMA = "voxeloid-corebench-1";
+const int NUM_RUNS = 3;
+
+struct Config
+{
+    uint8_t min_depth = 5;
+    uint8_t max_depth = 7;
+    std::vector<float> thresholds{ 0.2f, 0.3f, 0.4f };
+    size_t num_queries = 1 << 20;
+};
+
+// best of NUM_RUNS, in ns per call
+template <class F>
+double nsPerCall(size_t count, F&& f)
+{
+    double best = 0;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Timer timer;
+        f();
+        double ns = timer.RestartNS() / double(count);
+        if (run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+void writeMemory(std::ostream& out, const memory::Usage* before)
+{
+    out << "      \"memory\": {";
+    for (int i = 0; i < int(MemoryCategory::Count); i++)
+    {
+        auto category = MemoryCategory(i);
+        memory::Usage usage = memory::usage(category);
+        out << (i ? ", " : "") << "\"" << memory::categoryName(category)
+            << "\": {\"live_bytes\": " << usage.live
+            << ", \"peak_bytes\": " << usage.peak << ", \"allocations\": "
+            << usage.allocations - before[i].allocations << "}";
+    }
+    out << "}";
+}
+
+void writeResult(std::ostream& out, const Config& config, uint8_t depth,
+                 float threshold)
+{
+    memory::Usage before[int(MemoryCategory::Count)];
+    for (int i = 0; i < int(MemoryCategory::Count); i++)
+    {
+        memory::resetPeak(MemoryCategory(i));
+        before[i] = memory::usage(MemoryCategory(i));
+    }
+
+    out << "    {\n";
+    out << "      \"depth\": " << int(depth) << ",\n";
+    out << "      \"threshold\": " << threshold << ",\n";
+
+    std::unique_ptr<VoxelOctree> octree;
+    try
+    {
+        octree = std::make_unique<VoxelOctree>(depth, threshold);
+    }
+    catch (const std::exception& e)
+    {
+        std::string message = e.what();
+        for (auto& c : message)
+            if (c == '"' || c == '\n' || c == '\t' || c == '\\') c = ' ';
+        out << "      \"error\": \"" << message << "\",\n";
+        writeMemory(out, before);
+        out << "\n    }";
+        return;
+    }
+
+    const VoxelOctree::BuildTimes& times = octree->getBuildTimes();
+    double leaves = glm::pow(8.0, double(depth));
+    out << "      \"error\": null,\n";
+    out << "      \"texture_side\": " << octree->getIndirectSize() << ",\n";
+    out << "      \"startGeneration\": {\"seconds\": " << times.build_seconds
+        << ", \"leaves_per_second\": " << leaves / times.build_seconds
+        << "},\n";
+    out << "      \"createIndirectTexture\": {\"seconds\": "
+        << times.texture_seconds << ", \"bytes\": "
+        << octree->getIndirectTexture().size() << "},\n";
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    std::uniform_int_distribution<uint32_t> cell_dist(0, (1u << depth) - 1);
+    std::vector<glm::vec3> positions(config.num_queries);
+    for (auto& pos : positions)
+        pos = { dist(rng), dist(rng), dist(rng) };
+    std::vector<LocCode> locs(config.num_queries);
+    for (auto& loc : locs)
+        loc = VoxelOctree::locCodeFromCell(
+            { cell_dist(rng), cell_dist(rng), cell_dist(rng) }, depth);
+
+    // the sums keep the queries from being optimized away
+    size_t hits = 0;
+    double is_voxel_ns = nsPerCall(positions.size(), [&]() {
+        for (auto& pos : positions)
+            hits += octree->isVoxel(pos);
+    });
+    double is_voxel2_ns = nsPerCall(positions.size(), [&]() {
+        for (auto& pos : positions)
+            hits += octree->isVoxel2(pos);
+    });
+    glm::vec3 pos_sum{ 0 };
+    double calc_pos_ns = nsPerCall(locs.size(), [&]() {
+        for (LocCode loc : locs)
+            pos_sum += octree->calcPos(loc);
+    });
+
+    out << "      \"isVoxel\": {\"ns_per_query\": " << is_voxel_ns << "},\n";
+    out << "      \"isVoxel2\": {\"ns_per_query\": " << is_voxel2_ns << "},\n";
+    out << "      \"calcPos\": {\"ns_per_call\": " << calc_pos_ns << "},\n";
+    out << "      \"hit_fraction\": "
+        << double(hits) / (2.0 * NUM_RUNS * positions.size()) << ",\n";
+    writeMemory(out, before);
+    out << "\n    }";
+
+    // keeps pos_sum alive without adding a field to the schema
+    if (glm::isnan(pos_sum.x)) std::cerr << "calcPos returned NaN\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Config config;
+    std::string out_path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = [&](int count) {
+            if (i + count >= argc)
+            {
+                std::cerr << "Missing value for " << argv[i] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            return argv + i + 1;
+        };
+
+        if (strcmp(argv[i], "--depths") == 0)
+        {
+            config.min_depth = uint8_t(atoi(arg(2)[0]));
+            config.max_depth = uint8_t(atoi(arg(2)[1]));
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--thresholds") == 0)
+        {
+            config.thresholds.clear();
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                config.thresholds.push_back(float(atof(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--queries") == 0)
+        {
+            config.num_queries = size_t(glm::max(1, atoi(arg(1)[0])));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--out") == 0)
+        {
+            out_path = arg(1)[0];
+            i += 1;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"schema\": \"" << SCHEMA << "\",\n";
+#ifdef __AVX2__
+    out << "  \"avx2\": true,\n";
+#else
+    out << "  \"avx2\": false,\n";
+#endif
+    out << "  \"queries\": " << config.num_queries << ",\n";
+    out << "  \"runs\": " << NUM_RUNS << ",\n";
+    out << "  \"results\": [\n";
+    bool first = true;
+    for (uint8_t depth = config.min_depth; depth <= config.max_depth; depth++)
+    {
+        for (float threshold : config.thresholds)
+        {
+            std::cerr << "depth " << int(depth) << ", threshold " << threshold
+                      << "\n";
+            if (!first) out << ",\n";
+            first = false;
+            writeResult(out, config, depth, threshold);
+        }
+    }
+    out << "\n  ]\n}\n";
+
+    if (out_path.empty())
+    {
+        std::cout << out.str();
+    }
+    else
+    {
+        std::ofstream file(out_path);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file: '" << out_path << "'\n";
+            return EXIT_FAILURE;
+        }
+        file << out.str();
+    }
+    return EXIT_SUCCESS;
+}
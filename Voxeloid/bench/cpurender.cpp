@@ -0,0 +1,437 @@
+#include "camerapath.hpp"
+#include "cpurenderer.hpp"
+#include "frametimes.hpp"
+#include "util/profiler.hpp"
+#include "voxelimport.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+double psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+{
+    double squared = 0;
+    for (size_t i = 0; i < a.size(); i += 4)
+    {
+        for (size_t c = 0; c < 3; c++)
+        {
+            double diff = double(a[i + c]) - double(b[i + c]);
+            squared += diff * diff;
+        }
+    }
+    double mse = squared / (3 * (a.size() / 4));
+    return mse == 0 ? INFINITY : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+// Pixels where an integer cell traversal hits another surface than the
+// stack traversal, or only one of them hits. Hits count as the same within
+// a tenth of the finest voxel, the stack traversal overshoots each boundary
+// by a hundredth.
+struct TraversalDiff
+{
+    uint64_t pixels = 0;
+    uint64_t different = 0;
+    // of the different pixels, voxels that the stack traversal stepped over
+    // and the other one hit
+    uint64_t stack_missed = 0;
+    // hits of the other traversal where the ray crosses two planes within
+    // float precision and only touches the voxel at an edge or corner
+    uint64_t edge_touches = 0;
+    float max_distance = 0;
+
+    void add(VoxelOctree& voxels, const Camera& camera, uint32_t width,
+             uint32_t height, const std::vector<glm::vec4>& other,
+             const std::vector<glm::vec4>& stack)
+    {
+        float resolution = float(1 << voxels.getDepth());
+        float aspect = float(width) / float(height);
+
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                float a = other[size_t(y) * width + x].w;
+                float b = stack[size_t(y) * width + x].w;
+                pixels++;
+                if (a < 0 && b < 0) continue;
+                if (a >= 0 && b >= 0 && glm::abs(a - b) < 0.1f / resolution)
+                {
+                    max_distance = glm::max(max_distance, glm::abs(a - b));
+                    continue;
+                }
+
+                different++;
+                if (a < 0) continue;
+                glm::vec2 ndc = 2.f * (glm::vec2(x, y) + 0.5f) /
+                                    glm::vec2(width, height) -
+                                1.f;
+                glm::vec3 dir = glm::normalize(camera.rayDir(ndc, aspect));
+                // in finest cells
+                glm::vec3 hit = (camera.position + a * dir) * resolution;
+                glm::vec3 behind = (hit + 1e-3f * dir) / resolution;
+                if (voxels.isVoxel(2.f * glm::fract(behind) - 1.f))
+                {
+                    if (b < 0 || a < b) stack_missed++;
+                    continue;
+                }
+                glm::bvec3 on_plane = glm::lessThan(
+                    glm::abs(hit - glm::round(hit)), glm::vec3(2e-3f));
+                if (int(on_plane.x) + on_plane.y + on_plane.z >= 2)
+                    edge_touches++;
+            }
+        }
+    }
+
+    void print(std::ostream& out) const
+    {
+        out << "stack traversal: " << pixels - different << " of " << pixels
+            << " pixels hit the same surface, within " << max_distance
+            << "\n";
+        out << "                 " << different << " differ, "
+            << stack_missed << " voxels the stack traversal stepped over, "
+            << edge_touches << " edge touches, "
+            << different - stack_missed - edge_touches << " others\n";
+    }
+};
+
+} // namespace
+
+// Renders one view with the CPU reference renderer and reports rays/s and
+// steps/ray.
+//   cpurender [--scene file | --depth n] [--size w h] [--pos x y z]
+//             [--yaw a] [--pitch a] [--runs n] [--out file.png]
+//             [--play path.txt] [--timestep s] [--trace file.json]
+//             [--beam block] [--checkerboard] [--stackless] [--dda]
+//             [--deep] [--lod bias] [--heatmap steps|depth|fetches]
+//             [--heatmap-json file.json] [--info]
+// --depth builds the default noise scene with n levels instead. --info
+// prints the octree's node counts and memory per level before rendering.
+// --play renders every frame of a camera path recorded by Voxeloid
+// --record instead of one view and reports the frame times. --beam starts
+// the rays of every block x block pixels after a cone prepass, steps/ray
+// then counts the rays' own steps and beam steps/ray the cone steps.
+// --checkerboard traces half the pixels per frame, with --play every frame
+// is also traced in full to report the PSNR of the reconstruction.
+// --stackless uses the restarting traversal and --dda the integer one
+// with a node stack, either compares every pixel to the one of the stack
+// traversal. --deep tracks their rays relative to the camera's cell, see
+// deepbench for trees where that matters. --lod stops them at nodes
+// smaller than a pixel times 2^bias, one view is also rendered at full
+// depth to report the PSNR of the level of detail.
+// --heatmap renders the metric as colors instead of the shading and prints
+// the percentiles of every metric over all frames, --heatmap-json then
+// writes their histograms.
+int main(int argc, char** argv)
+{
+    std::string scene;
+    std::string out;
+    std::string play;
+    std::string trace;
+    float timestep = 1.f / 60.f;
+    uint32_t width = 1600;
+    uint32_t height = 900;
+    int runs = 1;
+    uint32_t beam_block = 0;
+    bool checkerboard = false;
+    Traversal traversal = Traversal::Stack;
+    bool deep = false;
+    bool lod = false;
+    bool info = false;
+    float lod_bias = 0.f;
+    int depth = 0;
+    HeatmapMetric heatmap = HeatmapMetric::None;
+    std::string heatmap_json;
+    Camera camera;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = [&](int count) {
+            if (i + count >= argc)
+            {
+                std::cerr << "Missing value for " << argv[i] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            return argv + i + 1;
+        };
+
+        if (strcmp(argv[i], "--scene") == 0)
+        {
+            scene = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--depth") == 0)
+        {
+            depth = atoi(arg(1)[0]);
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--size") == 0)
+        {
+            width = atoi(arg(2)[0]);
+            height = atoi(arg(2)[1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--pos") == 0)
+        {
+            char** values = arg(3);
+            camera.position = { atof(values[0]), atof(values[1]),
+                                atof(values[2]) };
+            i += 3;
+        }
+        else if (strcmp(argv[i], "--yaw") == 0)
+        {
+            camera.yaw = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--pitch") == 0)
+        {
+            camera.pitch = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--runs") == 0)
+        {
+            runs = glm::max(1, atoi(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--out") == 0)
+        {
+            out = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            trace = arg(1)[0];
+            profiler::setEnabled(true);
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--play") == 0)
+        {
+            play = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--timestep") == 0)
+        {
+            timestep = float(glm::max(1e-3, atof(arg(1)[0])));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--checkerboard") == 0)
+        {
+            checkerboard = true;
+        }
+        else if (strcmp(argv[i], "--stackless") == 0)
+        {
+            traversal = Traversal::Stackless;
+        }
+        else if (strcmp(argv[i], "--dda") == 0)
+        {
+            traversal = Traversal::Dda;
+        }
+        else if (strcmp(argv[i], "--deep") == 0)
+        {
+            deep = true;
+        }
+        else if (strcmp(argv[i], "--lod") == 0)
+        {
+            lod = true;
+            lod_bias = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--heatmap") == 0)
+        {
+            if (!parseHeatmapMetric(arg(1)[0], heatmap))
+            {
+                std::cerr << "Unknown heatmap metric " << argv[i + 1]
+                          << "\n";
+                return EXIT_FAILURE;
+            }
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--heatmap-json") == 0)
+        {
+            heatmap_json = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--info") == 0)
+        {
+            info = true;
+        }
+        else if (strcmp(argv[i], "--beam") == 0)
+        {
+            beam_block = glm::max(0, atoi(arg(1)[0]));
+            i += 1;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    try
+    {
+        std::unique_ptr<VoxelOctree> voxels;
+        if (!scene.empty())
+        {
+            VoxelGrid grid = importVoxels(scene);
+            voxels = std::make_unique<VoxelOctree>(grid.voxels, grid.depth);
+        }
+        else if (depth > 0)
+        {
+            voxels = std::make_unique<VoxelOctree>(uint8_t(depth), 0.3f);
+        }
+        else
+        {
+            voxels = std::make_unique<VoxelOctree>();
+        }
+
+        if (info) voxels->printInfo();
+
+        CpuRenderer renderer(*voxels);
+        renderer.setBeamBlock(beam_block);
+        renderer.setCheckerboard(checkerboard);
+        renderer.setTraversal(traversal);
+        renderer.setDeepPrecision(deep);
+        renderer.setLod(lod, lod_bias);
+        renderer.setHeatmap(heatmap);
+        std::vector<uint8_t> rgba;
+        CostHistogram costs;
+
+        // the stack traversal of the same frames for --stackless and --dda
+        CpuRenderer stack_renderer(*voxels);
+        stack_renderer.setBeamBlock(beam_block);
+        std::vector<uint8_t> stack_rgba;
+        RenderStats stack_total;
+        TraversalDiff diff;
+        auto compareTraversals = [&](const Camera& frame_camera) {
+            RenderStats stats = stack_renderer.render(frame_camera, width,
+                                                      height, stack_rgba);
+            stack_total.rays += stats.rays;
+            stack_total.steps += stats.steps;
+            diff.add(*voxels, frame_camera, width, height,
+                     renderer.lastFrame(), stack_renderer.lastFrame());
+        };
+
+        if (!play.empty())
+        {
+            CameraPath path = CameraPath::load(play);
+            FrameTimes frame_times;
+            RenderStats total;
+            CpuRenderer reference(*voxels);
+            std::vector<uint8_t> reference_rgba;
+            double psnr_sum = 0;
+            double psnr_min = INFINITY;
+            uint32_t frames = path.frameCount(timestep);
+            for (uint32_t frame = 0; frame < frames; frame++)
+            {
+                Camera frame_camera = path.sample(frame * timestep);
+                RenderStats stats =
+                    renderer.render(frame_camera, width, height, rgba);
+                frame_times.add(stats.seconds);
+                total.seconds += stats.seconds;
+                total.rays += stats.rays;
+                total.steps += stats.steps;
+                total.beam_steps += stats.beam_steps;
+                costs.add(stats.costs);
+
+                if (traversal != Traversal::Stack)
+                {
+                    compareTraversals(frame_camera);
+                }
+                if (checkerboard)
+                {
+                    reference.render(frame_camera, width, height,
+                                     reference_rgba);
+                    double frame_psnr = psnr(rgba, reference_rgba);
+                    psnr_sum += std::isinf(frame_psnr) ? 100 : frame_psnr;
+                    psnr_min = std::min(psnr_min, frame_psnr);
+                }
+            }
+
+            frame_times.printReport(std::cout);
+            std::cout << "rays/s:    " << total.raysPerSecond() << "\n";
+            std::cout << "steps/ray: " << total.stepsPerRay() << "\n";
+            if (beam_block > 0)
+            {
+                std::cout << "beam steps/ray: " << total.beamStepsPerRay()
+                          << "\n";
+            }
+            if (checkerboard && frames > 0)
+            {
+                double pixels = double(width) * height * frames;
+                std::cout << "traced:    " << 100 * total.rays / pixels
+                          << "% of the pixels\n";
+                std::cout << "psnr:      " << psnr_sum / frames
+                          << " dB mean (infinite counts as 100), "
+                          << psnr_min << " dB min\n";
+            }
+        }
+        else
+        {
+            RenderStats best;
+            for (int run = 0; run < runs; run++)
+            {
+                RenderStats stats =
+                    renderer.render(camera, width, height, rgba);
+                if (run == 0 || stats.seconds < best.seconds) best = stats;
+            }
+            costs.add(best.costs);
+            if (traversal != Traversal::Stack)
+            {
+                compareTraversals(camera);
+            }
+
+            std::cout << width << "x" << height << " in "
+                      << 1e3 * best.seconds << " ms\n";
+            std::cout << "rays/s:    " << best.raysPerSecond() << "\n";
+            std::cout << "steps/ray: " << best.stepsPerRay() << "\n";
+            if (beam_block > 0)
+            {
+                std::cout << "beam steps/ray: " << best.beamStepsPerRay()
+                          << "\n";
+            }
+            if (lod)
+            {
+                CpuRenderer full_depth(*voxels);
+                full_depth.setBeamBlock(beam_block);
+                full_depth.setTraversal(traversal);
+                full_depth.setDeepPrecision(deep);
+                std::vector<uint8_t> full_rgba;
+                RenderStats stats =
+                    full_depth.render(camera, width, height, full_rgba);
+                std::cout << "full depth steps/ray: " << stats.stepsPerRay()
+                          << ", lod psnr " << psnr(rgba, full_rgba)
+                          << " dB\n";
+            }
+        }
+
+        if (traversal != Traversal::Stack)
+        {
+            std::cout << "stack steps/ray: " << stack_total.stepsPerRay()
+                      << "\n";
+            diff.print(std::cout);
+        }
+        if (heatmap != HeatmapMetric::None)
+        {
+            costs.printReport(std::cout);
+            if (!heatmap_json.empty()) costs.writeJSON(heatmap_json);
+        }
+
+        if (!out.empty())
+        {
+            CpuRenderer::writePNG(out, rgba, width, height);
+        }
+        if (!trace.empty())
+        {
+            profiler::writeChromeTrace(trace);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
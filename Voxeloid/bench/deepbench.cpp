@@ -0,0 +1,212 @@
+#include "cpurenderer.hpp"
+#include "util/timer.hpp"
+#include "voxeloctree.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+
+// Checks the DDA traversal of CpuRenderer on sparse trees deeper than
+// floats resolve from the octree's origin. The camera looks at a cloud of
+// single finest voxels a few dozen cells away, every pixel is compared to
+// a DDA in doubles, with and without deep precision. Fails when deep
+// precision gets a pixel wrong. The stackless traversal shares the cell
+// arithmetic but runs out of steps at these depths.
+//   deepbench [--depths min max] [--size w h]
+
+namespace
+{
+// the cloud, a cube of CLOUD_SIZE cells with CLOUD_DENSITY of them solid,
+// centered CLOUD_DISTANCE cells in front of the camera
+const int CLOUD_SIZE = 48;
+const float CLOUD_DENSITY = 0.05f;
+const double CLOUD_DISTANCE = 64.0;
+// reference hits further than this many cells are misses, the renderer
+// would see the next repetition of the octree
+const double MAX_CELLS = 256.0;
+// hit distances in cells that still count as the same hit
+const double TOLERANCE = 0.01;
+
+uint64_t key(glm::i64vec3 cell)
+{
+    return uint64_t(cell.x) | uint64_t(cell.y) << 21 | uint64_t(cell.z) << 42;
+}
+
+// Distance in finest cells along dir to the first solid cell, -1 for none
+double referenceHit(const std::unordered_set<uint64_t>& solid,
+                    glm::dvec3 origin, glm::dvec3 dir)
+{
+    glm::i64vec3 cell = glm::i64vec3(glm::floor(origin));
+    glm::i64vec3 step = glm::i64vec3(glm::sign(dir));
+    glm::dvec3 inv_dir = 1.0 / glm::abs(dir);
+    glm::dvec3 next_t =
+        (glm::dvec3(cell) + glm::max(glm::dvec3(step), 0.0) - origin) *
+        glm::sign(dir) * inv_dir;
+    // parallel axes never cross
+    next_t = glm::mix(next_t, glm::dvec3(INFINITY),
+                      glm::equal(dir, glm::dvec3(0)));
+
+    double t = 0.0;
+    while (t < MAX_CELLS)
+    {
+        if (solid.count(key(cell))) return t;
+        int axis = next_t.x < next_t.y ? (next_t.x < next_t.z ? 0 : 2)
+                                       : (next_t.y < next_t.z ? 1 : 2);
+        t = next_t[axis];
+        next_t[axis] += inv_dir[axis];
+        cell[axis] += step[axis];
+    }
+    return -1.0;
+}
+
+struct Result
+{
+    size_t hits = 0;
+    // hit where the reference misses or the other way around, or another
+    // distance
+    size_t wrong = 0;
+    // largest difference in cells of the hits that are right
+    double max_error = 0.0;
+    double steps_per_ray = 0.0;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int min_depth = 16;
+    int max_depth = VoxelOctree::MAX_SUPPORTED_DEPTH;
+    uint32_t width = 320;
+    uint32_t height = 180;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = [&](int count) {
+            if (i + count >= argc)
+            {
+                std::cerr << "Missing value for " << argv[i] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            return argv + i + 1;
+        };
+
+        if (strcmp(argv[i], "--depths") == 0)
+        {
+            min_depth = atoi(arg(2)[0]);
+            max_depth = atoi(arg(2)[1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--size") == 0)
+        {
+            width = atoi(arg(2)[0]);
+            height = atoi(arg(2)[1]);
+            i += 2;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    max_depth = glm::min(max_depth, int(VoxelOctree::MAX_SUPPORTED_DEPTH));
+
+    // off the cell grid at every depth
+    Camera camera;
+    camera.position = glm::vec3(0.61803f, 0.41421f, 0.73205f);
+    camera.yaw = 0.7f;
+    camera.pitch = -0.3f;
+    float aspect = float(width) / float(height);
+
+    bool failed = false;
+    for (int depth = min_depth; depth <= max_depth; depth++)
+    {
+        const double resolution = double(1 << depth);
+        glm::dvec3 origin = glm::dvec3(camera.position) * resolution;
+
+        std::mt19937 rng(depth);
+        std::uniform_real_distribution<float> uniform(0.f, 1.f);
+        glm::dvec3 center =
+            origin + CLOUD_DISTANCE * glm::dvec3(camera.direction());
+        glm::i64vec3 cloud_min =
+            glm::i64vec3(glm::floor(center)) - int64_t(CLOUD_SIZE / 2);
+        std::vector<glm::uvec3> cells;
+        std::unordered_set<uint64_t> solid;
+        for (int z = 0; z < CLOUD_SIZE; z++)
+            for (int y = 0; y < CLOUD_SIZE; y++)
+                for (int x = 0; x < CLOUD_SIZE; x++)
+                {
+                    if (uniform(rng) >= CLOUD_DENSITY) continue;
+                    glm::i64vec3 cell = cloud_min + glm::i64vec3(x, y, z);
+                    cells.push_back(glm::uvec3(cell));
+                    solid.insert(key(cell));
+                }
+
+        VoxelOctree voxels(cells, uint8_t(depth));
+        CpuRenderer renderer(voxels);
+        renderer.setTraversal(Traversal::Dda);
+        std::cout << "depth " << depth << ", " << cells.size()
+                  << " voxels, indirect texture "
+                  << voxels.getIndirectTexture().size() << " bytes\n";
+
+        // same rays as CpuRenderer::render
+        std::vector<double> reference(size_t(width) * height);
+        size_t reference_hits = 0;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                glm::vec2 ndc = 2.f * (glm::vec2(x, y) + 0.5f) /
+                                    glm::vec2(width, height) -
+                                1.f;
+                glm::vec3 ray_dir =
+                    glm::normalize(camera.rayDir(ndc, aspect));
+                double t =
+                    referenceHit(solid, origin, glm::dvec3(ray_dir));
+                reference[size_t(y) * width + x] = t;
+                reference_hits += t >= 0.0;
+            }
+        }
+        std::cout << "  reference: " << reference_hits << " of "
+                  << reference.size() << " pixels hit\n";
+
+        for (bool deep : { false, true })
+        {
+            renderer.setDeepPrecision(deep);
+            std::vector<uint8_t> rgba;
+            Timer timer;
+            RenderStats stats = renderer.render(camera, width, height, rgba);
+            double seconds = timer.Restart();
+
+            Result result;
+            result.steps_per_ray = stats.stepsPerRay();
+            const std::vector<glm::vec4>& frame = renderer.lastFrame();
+            for (size_t i = 0; i < frame.size(); i++)
+            {
+                double t = frame[i].w * resolution;
+                if (t >= MAX_CELLS) t = -1.0;
+                result.hits += t >= 0.0;
+                if ((t >= 0.0) != (reference[i] >= 0.0))
+                {
+                    result.wrong++;
+                }
+                else if (t >= 0.0)
+                {
+                    double error = glm::abs(t - reference[i]);
+                    if (error > TOLERANCE)
+                        result.wrong++;
+                    else
+                        result.max_error = glm::max(result.max_error, error);
+                }
+            }
+
+            std::cout << (deep ? "  deep:     " : "  absolute: ")
+                      << result.hits << " hits, " << result.wrong
+                      << " wrong, max error " << result.max_error
+                      << " cells, " << result.steps_per_ray
+                      << " steps/ray, " << 1e3 * seconds << " ms\n";
+            if (deep && result.wrong > 0) failed = true;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
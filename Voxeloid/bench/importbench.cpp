@@ -0,0 +1,142 @@
+#include "util/timer.hpp"
+#include "voxelimport.hpp"
+#include "voxeloctree.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// Times the bulk builder against the noise generation of the same cells
+// and checks that both build the same nodes. Also imports a small
+// asymmetric MagicaVoxel model and checks that it keeps its handedness.
+// Fails when either check does.
+//   importbench [--depths min max]
+
+namespace
+{
+// the noise scene's cells, sampled at the cell centers
+std::vector<glm::uvec3> sceneCells(VoxelOctree& octree, uint8_t depth)
+{
+    const uint32_t side = 1u << depth;
+    std::vector<glm::uvec3> cells;
+    for (uint32_t z = 0; z < side; z++)
+        for (uint32_t y = 0; y < side; y++)
+            for (uint32_t x = 0; x < side; x++)
+            {
+                glm::vec3 pos =
+                    (glm::vec3(x, y, z) + 0.5f) * (2.f / float(side)) - 1.f;
+                if (octree.isVoxel(pos)) cells.push_back({ x, y, z });
+            }
+    return cells;
+}
+
+void writeU32(std::ofstream& file, uint32_t value)
+{
+    uint8_t bytes[4] = { uint8_t(value), uint8_t(value >> 8),
+                         uint8_t(value >> 16), uint8_t(value >> 24) };
+    file.write(reinterpret_cast<const char*>(bytes), 4);
+}
+
+void writeChunk(std::ofstream& file, const char* id, uint32_t content_size,
+                uint32_t children_size)
+{
+    file.write(id, 4);
+    writeU32(file, content_size);
+    writeU32(file, children_size);
+}
+
+// One model of size 4, a corner voxel with arms of 1, 2 and 3 voxels
+// along MagicaVoxel's x, y and z, so every axis can be told apart
+bool checkVoxHandedness()
+{
+    const uint32_t SIZE = 4;
+    std::vector<glm::uvec3> voxels = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 },
+                                       { 0, 2, 0 }, { 0, 0, 1 }, { 0, 0, 2 },
+                                       { 0, 0, 3 } };
+
+    std::string filename =
+        (std::filesystem::temp_directory_path() / "importbench.vox").string();
+    {
+        std::ofstream file(filename, std::ios::binary);
+        uint32_t size_chunk = 12 + 12;
+        uint32_t xyzi_chunk = 12 + 4 + 4 * uint32_t(voxels.size());
+        file.write("VOX ", 4);
+        writeU32(file, 150);
+        writeChunk(file, "MAIN", 0, size_chunk + xyzi_chunk);
+        writeChunk(file, "SIZE", 12, 0);
+        for (int i = 0; i < 3; i++)
+            writeU32(file, SIZE);
+        writeChunk(file, "XYZI", xyzi_chunk - 12, 0);
+        writeU32(file, uint32_t(voxels.size()));
+        for (auto& voxel : voxels)
+        {
+            uint8_t xyzi[4] = { uint8_t(voxel.x), uint8_t(voxel.y),
+                                uint8_t(voxel.z), 1 };
+            file.write(reinterpret_cast<const char*>(xyzi), 4);
+        }
+    }
+    VoxelGrid grid = importVox(filename);
+    std::filesystem::remove(filename);
+
+    // the arm ends relative to the corner, in renderer space
+    glm::ivec3 corner = glm::ivec3(grid.voxels[0]);
+    glm::ivec3 x_arm = glm::ivec3(grid.voxels[1]) - corner;
+    glm::ivec3 y_arm = glm::ivec3(grid.voxels[3]) - corner;
+    glm::ivec3 z_arm = glm::ivec3(grid.voxels[6]) - corner;
+
+    // z-up becomes y-up, and the axes still form a right-handed frame
+    bool right_handed =
+        glm::dot(glm::cross(glm::vec3(x_arm), glm::vec3(y_arm)),
+                 glm::vec3(z_arm)) > 0.f;
+    bool up = z_arm == glm::ivec3(0, 3, 0);
+    std::cout << ".vox import: z arm " << z_arm.x << " " << z_arm.y << " "
+              << z_arm.z << ", " << (right_handed ? "right" : "left")
+              << "-handed\n";
+    return up && right_handed;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int min_depth = 4;
+    int max_depth = 7;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--depths") == 0 && i + 2 < argc)
+        {
+            min_depth = atoi(argv[i + 1]);
+            max_depth = atoi(argv[i + 2]);
+            i += 2;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool failed = !checkVoxHandedness();
+
+    for (int depth = min_depth; depth <= max_depth; depth++)
+    {
+        Timer timer;
+        VoxelOctree generated(uint8_t(depth), 0.3f);
+        double generate_ms = timer.RestartMS();
+
+        std::vector<glm::uvec3> cells = sceneCells(generated, uint8_t(depth));
+        timer.Restart();
+        VoxelOctree built(cells, uint8_t(depth));
+        double build_ms = timer.RestartMS();
+
+        bool same = generated.sameNodes(built);
+        failed |= !same;
+        std::cout << "depth " << depth << ", " << cells.size()
+                  << " voxels: generate " << generate_ms << " ms, bulk build "
+                  << build_ms << " ms, "
+                  << (same ? "same nodes" : "DIFFERENT NODES") << "\n";
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,415 @@
+#include "cpurenderer.hpp"
+#include "util/memorytracker.hpp"
+#include "util/timer.hpp"
+#include "voxeloctree.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+// Performance regression gate. Builds a fixed corpus of noise scenes,
+// renders fixed views with the CPU reference renderer and compares times,
+// memory and output hashes against a baseline file.
+//   perfgate [--baseline file] [--update] [--runs n] [--tolerance r]
+// Exit code 0 if nothing regressed, 1 on a regression, 2 on errors. The
+// baseline defaults to perfgate_baseline.txt next to this file.
+//
+// Timings are the median of the runs, a time regresses when it exceeds
+// the baseline by more than the relative tolerance, three times the
+// larger median absolute deviation and MIN_TIME_DELTA_MS. When a time
+// regresses the corpus is measured again and the faster median is kept,
+// so one noisy burst does not fail the gate. Memory may grow by
+// MEMORY_TOLERANCE. Hashes must match exactly. Baselines depend on the
+// machine and compiler, regenerate them with --update on the gate machine.
+
+#ifndef PERFGATE_BASELINE
+#define PERFGATE_BASELINE "perfgate_baseline.txt"
+#endif
+
+namespace
+{
+const double MIN_TIME_DELTA_MS = 0.5;
+const double MEMORY_TOLERANCE = 0.02;
+const uint32_t VIEW_WIDTH = 256;
+const uint32_t VIEW_HEIGHT = 144;
+
+struct Scene
+{
+    uint8_t depth;
+    float threshold;
+    uint32_t seed;
+};
+
+const Scene CORPUS[] = {
+    { 5, 0.3f, 0 },
+    { 6, 0.3f, 1 },
+    { 6, 0.1f, 2 },
+    { 7, 0.4f, 3 },
+};
+
+Camera makeCamera(glm::vec3 position, float yaw, float pitch)
+{
+    Camera camera;
+    camera.position = position;
+    camera.yaw = yaw;
+    camera.pitch = pitch;
+    return camera;
+}
+
+// in empty space and facing geometry in every scene of the corpus
+const Camera VIEWS[] = {
+    makeCamera({ -0.15f, 0.01f, -0.15f }, 0.75f, 0.15f),
+    makeCamera({ -0.3f, 0.1f, -0.1f }, -1.15f, 0.15f),
+};
+
+enum class Kind
+{
+    Time,
+    Bytes,
+    Hash
+};
+
+struct Metric
+{
+    Kind kind;
+    // Time: median and median absolute deviation in ms, Bytes: value
+    double value = 0;
+    double mad = 0;
+    std::string hash = "";
+};
+
+using Metrics = std::map<std::string, Metric>;
+
+const char* kindName(Kind kind)
+{
+    switch (kind)
+    {
+    case Kind::Time: return "time";
+    case Kind::Bytes: return "bytes";
+    default: return "hash";
+    }
+}
+
+std::string fnv1a(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return out.str();
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+Metric timeMetric(const std::vector<double>& ms)
+{
+    Metric metric{ Kind::Time };
+    metric.value = median(ms);
+    std::vector<double> deviations;
+    for (double t : ms)
+        deviations.push_back(glm::abs(t - metric.value));
+    metric.mad = median(deviations);
+    return metric;
+}
+
+Metric bytesMetric(size_t bytes)
+{
+    Metric metric{ Kind::Bytes };
+    metric.value = double(bytes);
+    return metric;
+}
+
+Metric hashMetric(const std::string& hash)
+{
+    Metric metric{ Kind::Hash };
+    metric.hash = hash;
+    return metric;
+}
+
+void measureScene(const Scene& scene, int runs, Metrics& metrics)
+{
+    std::ostringstream name_stream;
+    name_stream << "d" << int(scene.depth) << "_t" << scene.threshold << "_s"
+                << scene.seed;
+    std::string name = name_stream.str();
+    std::cerr << name << "\n";
+
+    std::vector<double> generate_ms, texture_ms;
+    std::unique_ptr<VoxelOctree> octree;
+    for (int run = 0; run < runs; run++)
+    {
+        octree.reset();
+        octree = std::make_unique<VoxelOctree>(scene.depth, scene.threshold,
+                                               scene.seed);
+        generate_ms.push_back(1e3 * octree->getBuildTimes().build_seconds);
+        texture_ms.push_back(1e3 * octree->getBuildTimes().texture_seconds);
+    }
+
+    metrics[name + ".generate_ms"] = timeMetric(generate_ms);
+    metrics[name + ".texture_ms"] = timeMetric(texture_ms);
+    // the gen_maps peak depends on how the octant tasks overlap, so only
+    // the final structures are compared
+    metrics[name + ".nodes_bytes"] =
+        bytesMetric(memory::usage(MemoryCategory::Nodes).live);
+    auto& texture = octree->getIndirectTexture();
+    metrics[name + ".texture_bytes"] = bytesMetric(texture.size());
+    metrics[name + ".texture_hash"] =
+        hashMetric(fnv1a(texture.data(), texture.size()));
+
+    CpuRenderer renderer(*octree);
+    std::vector<uint8_t> rgba;
+    for (size_t view = 0; view < std::size(VIEWS); view++)
+    {
+        std::vector<double> render_ms;
+        // warm up caches and threads
+        renderer.render(VIEWS[view], VIEW_WIDTH, VIEW_HEIGHT, rgba);
+        for (int run = 0; run < runs; run++)
+        {
+            RenderStats stats =
+                renderer.render(VIEWS[view], VIEW_WIDTH, VIEW_HEIGHT, rgba);
+            render_ms.push_back(1e3 * stats.seconds);
+        }
+        std::string view_name = name + ".view" + std::to_string(view);
+        // a camera inside a voxel sees one color and measures nothing
+        const uint32_t* pixels =
+            reinterpret_cast<const uint32_t*>(rgba.data());
+        if (std::all_of(pixels, pixels + rgba.size() / 4,
+                        [&](uint32_t pixel) { return pixel == pixels[0]; }))
+        {
+            throw std::runtime_error(view_name + " renders a single color");
+        }
+        metrics[view_name + ".render_ms"] = timeMetric(render_ms);
+        metrics[view_name + ".image_hash"] =
+            hashMetric(fnv1a(rgba.data(), rgba.size()));
+    }
+}
+
+void writeBaseline(const std::string& filename, const Metrics& metrics)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Failed to open file: '" + filename + "'");
+    }
+    file << "# perfgate baseline, regenerate with perfgate --update\n";
+    file << "# time <name> <median ms> <mad ms> | bytes <name> <bytes> | "
+            "hash <name> <fnv1a>\n";
+    for (auto& [name, metric] : metrics)
+    {
+        file << kindName(metric.kind) << " " << name << " ";
+        if (metric.kind == Kind::Time)
+            file << metric.value << " " << metric.mad;
+        else if (metric.kind == Kind::Bytes)
+            file << size_t(metric.value);
+        else
+            file << metric.hash;
+        file << "\n";
+    }
+}
+
+Metrics readBaseline(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Failed to open file: '" + filename + "'");
+    }
+
+    Metrics metrics;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream stream(line);
+        std::string kind, name;
+        stream >> kind >> name;
+        Metric metric;
+        if (kind == "time")
+        {
+            metric.kind = Kind::Time;
+            stream >> metric.value >> metric.mad;
+        }
+        else if (kind == "bytes")
+        {
+            metric.kind = Kind::Bytes;
+            stream >> metric.value;
+        }
+        else if (kind == "hash")
+        {
+            metric.kind = Kind::Hash;
+            stream >> metric.hash;
+        }
+        if (!stream)
+        {
+            throw std::runtime_error("Bad baseline line: " + line);
+        }
+        metrics[name] = metric;
+    }
+    return metrics;
+}
+
+Metrics measureCorpus(int runs)
+{
+    Metrics metrics;
+    for (const Scene& scene : CORPUS)
+        measureScene(scene, runs, metrics);
+    return metrics;
+}
+
+// returns the number of regressions, prints every metric to out if given
+int compare(const Metrics& baseline, const Metrics& current, double tolerance,
+            std::ostream* out)
+{
+    std::ostringstream discard;
+    std::ostream& log = out ? *out : discard;
+
+    int regressions = 0;
+    for (auto& [name, metric] : current)
+    {
+        auto iter = baseline.find(name);
+        log << std::left << std::setw(36) << name << " ";
+        if (iter == baseline.end())
+        {
+            log << "new\n";
+            continue;
+        }
+        const Metric& base = iter->second;
+
+        bool regressed = false;
+        if (metric.kind == Kind::Time)
+        {
+            double allowed =
+                glm::max(tolerance * base.value,
+                         glm::max(3.0 * glm::max(base.mad, metric.mad),
+                                  MIN_TIME_DELTA_MS));
+            regressed = metric.value > base.value + allowed;
+            log << std::fixed << std::setprecision(3) << base.value << " -> "
+                << metric.value << " ms (allowed +" << allowed << ")";
+        }
+        else if (metric.kind == Kind::Bytes)
+        {
+            regressed = metric.value > base.value * (1.0 + MEMORY_TOLERANCE);
+            log << size_t(base.value) << " -> " << size_t(metric.value)
+                << " bytes";
+        }
+        else
+        {
+            regressed = metric.hash != base.hash;
+            log << base.hash << " -> " << metric.hash;
+        }
+        log << (regressed ? "  REGRESSION" : "") << "\n";
+        regressions += regressed;
+    }
+
+    for (auto& [name, metric] : baseline)
+    {
+        if (current.count(name) == 0)
+        {
+            log << std::left << std::setw(36) << name
+                << " missing  REGRESSION\n";
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string baseline_path = PERFGATE_BASELINE;
+    bool update = false;
+    int runs = 5;
+    double tolerance = 0.2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = [&](int count) {
+            if (i + count >= argc)
+            {
+                std::cerr << "Missing value for " << argv[i] << "\n";
+                exit(2);
+            }
+            return argv + i + 1;
+        };
+
+        if (strcmp(argv[i], "--baseline") == 0)
+        {
+            baseline_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--update") == 0)
+        {
+            update = true;
+        }
+        else if (strcmp(argv[i], "--runs") == 0)
+        {
+            runs = glm::max(1, atoi(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0)
+        {
+            tolerance = atof(arg(1)[0]);
+            i += 1;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    try
+    {
+        if (update)
+        {
+            Metrics current = measureCorpus(runs);
+            writeBaseline(baseline_path, current);
+            std::cout << "Wrote " << current.size() << " metrics to "
+                      << baseline_path << "\n";
+            return 0;
+        }
+
+        // a missing or broken baseline fails before the measurements
+        Metrics baseline = readBaseline(baseline_path);
+        Metrics current = measureCorpus(runs);
+        if (compare(baseline, current, tolerance, nullptr) > 0)
+        {
+            std::cerr << "Regressions found, measuring again\n";
+            Metrics retry = measureCorpus(runs);
+            for (auto& [name, metric] : current)
+            {
+                auto iter = retry.find(name);
+                if (metric.kind == Kind::Time && iter != retry.end() &&
+                    iter->second.value < metric.value)
+                {
+                    metric = iter->second;
+                }
+            }
+        }
+
+        int regressions = compare(baseline, current, tolerance, &std::cout);
+        std::cout << regressions << " regressions\n";
+        return regressions ? 1 : 0;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+}
@@ -0,0 +1,109 @@
+#include "util/timer.hpp"
+#include "voxeloctree.hpp"
+
+#include <bitset>
+#include <iostream>
+#include <random>
+
+// Sequential queries along a random walk, scalar isVoxel against the cursor
+size_t benchCoherent(VoxelOctree& voxels)
+{
+    const size_t NUM_QUERIES = 1 << 20;
+    const float STEP = 0.01f;
+
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    std::vector<glm::vec3> positions(NUM_QUERIES);
+    glm::vec3 pos{ 0 };
+    for (auto& p : positions)
+    {
+        pos += STEP * glm::vec3(dist(rng), dist(rng), dist(rng));
+        pos = glm::clamp(pos, glm::vec3(-1), glm::vec3(1));
+        p = pos;
+    }
+
+    const int NUM_RUNS = 5;
+    std::vector<bool> scalar(NUM_QUERIES), cursor(NUM_QUERIES);
+
+    double scalar_ns = 1e18, cursor_ns = 1e18;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Timer timer;
+        for (size_t i = 0; i < NUM_QUERIES; i++)
+            scalar[i] = voxels.isVoxel(positions[i]);
+        scalar_ns = glm::min(scalar_ns, timer.RestartNS());
+
+        VoxelOctree::Cursor voxel_cursor(voxels);
+        for (size_t i = 0; i < NUM_QUERIES; i++)
+            cursor[i] = voxel_cursor.isVoxel(positions[i]);
+        cursor_ns = glm::min(cursor_ns, timer.RestartNS());
+    }
+
+    std::cout << "coherent walk, step " << STEP << "\n";
+    std::cout << "isVoxel:         " << scalar_ns / NUM_QUERIES
+              << " ns/query\n";
+    std::cout << "Cursor::isVoxel: " << cursor_ns / NUM_QUERIES
+              << " ns/query\n\n";
+
+    return scalar == cursor ? 0 : 1;
+}
+
+// Compares the scalar point queries against isVoxelBatch on random positions
+int main()
+{
+    VoxelOctree voxels;
+
+    const size_t NUM_QUERIES = 1 << 20;
+    const int NUM_RUNS = 5;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    std::vector<glm::vec3> positions(NUM_QUERIES);
+    for (auto& pos : positions)
+        pos = { dist(rng), dist(rng), dist(rng) };
+
+    std::vector<uint64_t> scalar((NUM_QUERIES + 63) / 64);
+    std::vector<uint64_t> scalar2((NUM_QUERIES + 63) / 64);
+    std::vector<uint64_t> batch((NUM_QUERIES + 63) / 64);
+
+    double best_scalar = 1e9, best_scalar2 = 1e9, best_batch = 1e9;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Timer timer;
+        std::fill(scalar.begin(), scalar.end(), 0);
+        for (size_t i = 0; i < NUM_QUERIES; i++)
+        {
+            if (voxels.isVoxel(positions[i]))
+                scalar[i / 64] |= 1ULL << (i % 64);
+        }
+        best_scalar = glm::min(best_scalar, timer.RestartNS());
+
+        std::fill(scalar2.begin(), scalar2.end(), 0);
+        for (size_t i = 0; i < NUM_QUERIES; i++)
+        {
+            if (voxels.isVoxel2(positions[i]))
+                scalar2[i / 64] |= 1ULL << (i % 64);
+        }
+        best_scalar2 = glm::min(best_scalar2, timer.RestartNS());
+
+        voxels.isVoxelBatch(positions.data(), NUM_QUERIES, batch.data());
+        best_batch = glm::min(best_batch, timer.RestartNS());
+    }
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        mismatches += std::bitset<64>(batch[i] ^ scalar2[i]).count();
+        mismatches += std::bitset<64>(scalar[i] ^ scalar2[i]).count();
+    }
+
+    mismatches += benchCoherent(voxels);
+
+    std::cout << "queries:      " << NUM_QUERIES << "\n";
+    std::cout << "isVoxel:      " << best_scalar / NUM_QUERIES << " ns/query\n";
+    std::cout << "isVoxel2:     " << best_scalar2 / NUM_QUERIES << " ns/query\n";
+    std::cout << "isVoxelBatch: " << best_batch / NUM_QUERIES << " ns/query\n";
+    std::cout << "mismatches:   " << mismatches << "\n";
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,97 @@
+#include "util/timer.hpp"
+#include "voxeloctree.hpp"
+
+#include <iostream>
+
+namespace
+{
+const int WIDTH = 1024;
+const int HEIGHT = 576;
+const int NUM_RUNS = 5;
+
+// Camera rays in 4x2 pixel blocks, so each run of 8 rays is one packet
+std::vector<Ray> cameraRays(glm::vec3 cam_pos, glm::vec3 cam_dir)
+{
+    glm::vec3 side = glm::normalize(glm::cross(glm::vec3(0, 1, 0), cam_dir));
+    glm::vec3 cam_up = glm::normalize(glm::cross(side, cam_dir));
+    float aspect = float(WIDTH) / HEIGHT;
+
+    std::vector<Ray> rays;
+    for (int by = 0; by < HEIGHT; by += 2)
+        for (int bx = 0; bx < WIDTH; bx += 4)
+            for (int y = by; y < by + 2; y++)
+                for (int x = bx; x < bx + 4; x++)
+                {
+                    glm::vec2 ndc = 2.f * (glm::vec2(x, y) + 0.5f) /
+                                        glm::vec2(WIDTH, HEIGHT) -
+                                    1.f;
+                    glm::vec3 dir =
+                        cam_dir + aspect * ndc.x * side + ndc.y * cam_up;
+                    rays.push_back({ cam_pos, glm::normalize(dir) });
+                }
+    return rays;
+}
+
+void benchRays(VoxelOctree& voxels, const char* name,
+               const std::vector<Ray>& rays, size_t& mismatches)
+{
+    std::vector<RayHit> single(rays.size()), packets(rays.size());
+
+    double best_single = 1e9, best_packets = 1e9;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Timer timer;
+        voxels.raycast(rays.data(), rays.size(), 10.f, single.data());
+        best_single = glm::min(best_single, timer.RestartNS());
+        voxels.raycastPackets(rays.data(), rays.size(), 10.f, packets.data());
+        best_packets = glm::min(best_packets, timer.RestartNS());
+    }
+
+    size_t hits = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        hits += single[i].hit;
+        if (single[i].hit != packets[i].hit ||
+            single[i].loc != packets[i].loc ||
+            glm::abs(single[i].t - packets[i].t) > 1e-5f)
+        {
+            mismatches++;
+        }
+    }
+
+    std::cout << name << ", " << rays.size() << " rays, " << hits
+              << " hits\n";
+    std::cout << "  single: " << 1e3 * rays.size() / best_single
+              << " Mrays/s\n";
+    std::cout << "  packet: " << 1e3 * rays.size() / best_packets
+              << " Mrays/s\n";
+}
+
+} // namespace
+
+// Single ray against packet traversal on the default noise scene
+int main()
+{
+    VoxelOctree voxels;
+    size_t mismatches = 0;
+
+    glm::vec3 cam_pos{ -1.8f, 0.6f, -1.2f };
+    glm::vec3 cam_dir = glm::normalize(-cam_pos);
+    std::vector<Ray> camera = cameraRays(cam_pos, cam_dir);
+    benchRays(voxels, "camera", camera, mismatches);
+
+    // shadow rays from the primary hits toward one light
+    std::vector<RayHit> primary = voxels.raycast(camera, 10.f);
+    glm::vec3 light{ 3.f, 4.f, 2.f };
+    std::vector<Ray> shadow;
+    for (auto& hit : primary)
+    {
+        if (!hit.hit) continue;
+        glm::vec3 origin = hit.position + 1e-4f * hit.normal;
+        shadow.push_back({ origin, glm::normalize(light - origin) });
+    }
+    benchRays(voxels, "shadow", shadow, mismatches);
+
+    std::cout << "mismatches: " << mismatches << "\n";
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
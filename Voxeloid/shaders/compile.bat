@@ -1,3 +1,65 @@
-C:/VulkanSDK/1.1.121.2/Bin32/glslc.exe %~dp0/shader.vert -o %~dp0/shader_vert.spv
-C:/VulkanSDK/1.1.121.2/Bin32/glslc.exe %~dp0/shader.frag -o %~dp0/shader_frag.spv
-pause
\ No newline at end of file
+@echo off
+rem Builds the SPIR-V that is used when glslc is not found at runtime, one
+rem file per variant, suffixes in the order the renderer appends them.
+setlocal enabledelayedexpansion
+
+if "%VULKAN_SDK%"=="" (
+    echo compile.bat: VULKAN_SDK is not set, install the Vulkan SDK
+    exit /b 1
+)
+set GLSLC="%VULKAN_SDK%\Bin\glslc.exe"
+set DIR=%~dp0
+
+%GLSLC% %DIR%shader.vert -o %DIR%shader_vert.spv || exit /b 1
+%GLSLC% %DIR%beam.comp -o %DIR%beam_comp.spv || exit /b 1
+
+for %%b in (0 1) do (
+    for %%c in (0 1) do (
+        for %%t in (stack stackless dda) do (
+            for %%d in (0 1) do (
+                for %%h in (0 1) do (
+                    call :variant %%b %%c %%t %%d %%h || exit /b 1
+                )
+            )
+        )
+    )
+)
+exit /b 0
+
+rem beam checker traversal deep heatmap
+:variant
+set DEFINES=
+set SUFFIX=
+if %1==1 (
+    set DEFINES=!DEFINES! -DBEAM
+    set SUFFIX=!SUFFIX!_beam
+)
+if %2==1 (
+    set DEFINES=!DEFINES! -DCHECKERBOARD
+    set SUFFIX=!SUFFIX!_checker
+)
+if %3==stackless (
+    set DEFINES=!DEFINES! -DSTACKLESS
+    set SUFFIX=!SUFFIX!_stackless
+)
+if %3==dda (
+    set DEFINES=!DEFINES! -DDDA
+    set SUFFIX=!SUFFIX!_dda
+)
+rem the deep variants only exist for stackless and dda
+if %4==1 (
+    if %3==stack exit /b 0
+    set DEFINES=!DEFINES! -DDEEP
+    set SUFFIX=!SUFFIX!_deep
+)
+if %5==1 (
+    set DEFINES=!DEFINES! -DHEATMAP
+    set SUFFIX=!SUFFIX!_heatmap
+)
+
+%GLSLC% !DEFINES! %DIR%shader.comp -o %DIR%shader_comp!SUFFIX!.spv || exit /b 1
+rem the fragment path has no checkerboard or heatmap
+if %2==0 if %5==0 (
+    %GLSLC% !DEFINES! %DIR%shader.frag -o %DIR%shader_frag!SUFFIX!.spv || exit /b 1
+)
+exit /b 0
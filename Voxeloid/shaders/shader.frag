@@ -2,6 +2,13 @@
 #extension GL_KHR_vulkan_glsl : enable
 #extension GL_ARB_separate_shader_objects : enable
 
+// Set to the loaded tree's depth, the stacks are sized for it
+layout(constant_id = 0) const int MAX_DEPTH = 5;
+layout(constant_id = 1) const int NUM_STEPS = 512;
+// The integer traversals do not descend into nodes smaller than LOD_CONE
+// times their distance, the size of a pixel scaled by 2^lod_bias. 0 is off.
+layout(constant_id = 2) const float LOD_CONE = 0.0;
+
 layout(location = 0) out vec4 out_color;
 
 layout(location = 0) in vec2 in_uv;
@@ -14,6 +21,12 @@ layout(binding = 0) uniform UniformBufferObject {
 
 layout(binding = 1) uniform sampler3D tex_indirect;
 
+#ifdef BEAM
+// start distances of beam.comp, one per BEAM_BLOCK x BEAM_BLOCK pixels
+layout(binding = 3, r32f) uniform readonly image2D beam_image;
+const int BEAM_BLOCK = 8;
+#endif
+
 // https://gist.github.com/DomNomNom/46bb1ce47f68d255fd5d
 vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - rayOrigin) / rayDir;
@@ -33,7 +46,187 @@ vec3 voxel(vec3 lro, vec3 rd, vec3 ird, float size)
 
 const int INDIRECT_LEAF = 255;
 const int INDIRECT_EMPTY = 0;
-const int INDIRECT_NODE = 127;
+// nodes are the values in between, scaled by the solid fraction of their
+// volume, see VoxelOctree
+const int INDIRECT_NODE_MIN = 1;
+const int INDIRECT_NODE_MAX = 254;
+
+bool isNode(int node_info)
+{
+	return node_info != INDIRECT_LEAF && node_info != INDIRECT_EMPTY;
+}
+
+#if defined(STACKLESS) || defined(DDA)
+// Nodes smaller than the pixel cone at their distance are not descended
+// into, they are solid when at least LOD_MIN_OCCUPANCY of their volume is
+const float LOD_MIN_OCCUPANCY = 0.5;
+
+bool lodSolid(int node_info)
+{
+	float occupancy = float(node_info - INDIRECT_NODE_MIN) / float(INDIRECT_NODE_MAX - INDIRECT_NODE_MIN);
+	return occupancy >= LOD_MIN_OCCUPANCY;
+}
+
+float lodCone()
+{
+	return LOD_CONE;
+}
+
+// The ray origin in finest cells as base + origin, base is the origin's
+// cell in the DEEP variants and 0 otherwise. CpuRenderer::cellOrigin is
+// the reference.
+void cellOrigin(vec3 ray_ori, out ivec3 base, out vec3 origin)
+{
+	// scaling by a power of two and removing the integer part are exact
+	precise vec3 scaled = ray_ori * float(1 << MAX_DEPTH);
+#ifdef DEEP
+	base = ivec3(floor(scaled));
+#else
+	base = ivec3(0);
+#endif
+	origin = scaled - vec3(base);
+}
+
+// Leaves the empty node of size finest cells around cell through the plane
+// it exits at, t in finest cells moves there and cell to the finest cell
+// on the other side
+void exitNode(ivec3 base, vec3 origin, vec3 ray_dir, int size, inout float t, inout ivec3 cell)
+{
+	ivec3 positive = ivec3(greaterThan(ray_dir, vec3(0)));
+
+	ivec3 node_min = cell & ~(size - 1);
+	vec3 exit_t = (vec3(node_min + positive*size - base) - origin) * (1.0 / ray_dir);
+	// parallel axes never exit
+	exit_t = mix(exit_t, vec3(1e30), equal(ray_dir, vec3(0)));
+
+	int axis = exit_t.x < exit_t.y ? (exit_t.x < exit_t.z ? 0 : 2)
+	                               : (exit_t.y < exit_t.z ? 1 : 2);
+	t = max(t, exit_t[axis]);
+
+	// other planes crossed at a corner are kept, rounding back behind the
+	// node is not
+	ivec3 next = base + ivec3(floor(origin + t*ray_dir));
+	cell = mix(min(next, node_min + size - 1), max(next, node_min), bvec3(positive));
+	cell[axis] = positive[axis] != 0 ? node_min[axis] + size : node_min[axis] - 1;
+}
+#endif
+
+#ifdef STACKLESS
+// The ray is tracked by the integer coordinates of its finest cell and
+// every lookup restarts from the root, no stack is kept. CpuRenderer::
+// traceStackless is the reference. Returns the color and hit distance.
+vec4 traceStackless(vec3 ray_ori, vec3 ray_dir, float start_t)
+{
+	int resolution = 1 << MAX_DEPTH;
+
+	ivec3 base;
+	vec3 origin;
+	cellOrigin(ray_ori, base, origin);
+	float t = start_t * float(resolution);
+	float lod_cone = lodCone();
+	ivec3 cell = base + ivec3(floor(origin + t*ray_dir));
+
+	vec3 color = vec3(0);
+	float hit_t = -1.0;
+
+	int i = 0;
+	while (i < NUM_STEPS)
+	{
+		// solid finest voxels are nodes whose cell is all leaves, the
+		// lookups go one level deeper than the cells
+		ivec3 local = 2 * (cell & (resolution - 1));
+		ivec3 node_cell = ivec3(0);
+		int depth = 0;
+		ivec4 node_info;
+		bool lod = false;
+		for (; i < NUM_STEPS; i++)
+		{
+			ivec3 offset = (local >> (MAX_DEPTH - depth)) & 1;
+			node_info = ivec4(round(texelFetch(tex_indirect, 2*node_cell + offset, 0) * 255.0));
+			if (!isNode(node_info.w) || depth == MAX_DEPTH)
+				break;
+			lod = float(resolution >> (depth + 1)) < lod_cone * t;
+			if (lod)
+				break;
+			node_cell = node_info.xyz;
+			depth++;
+		}
+		if (i == NUM_STEPS)
+			break;
+		i++;
+
+		if (node_info.w == INDIRECT_LEAF || (lod && lodSolid(node_info.w)))
+		{
+			hit_t = t / float(resolution);
+			color = vec3(1,0,0) * smoothstep(4,0,hit_t);
+			break;
+		}
+
+		// the empty child of the last lookup, size in finest cells
+		exitNode(base, origin, ray_dir, max(1, resolution >> (depth + 1)), t, cell);
+	}
+	return vec4(color, hit_t);
+}
+#endif
+
+#ifdef DDA
+// The ray is tracked by its finest cell like in STACKLESS, but the texture
+// cells of the nodes above it are kept. After an exit the lookups resume
+// at the deepest node that also holds the next cell. CpuRenderer::traceDda
+// is the reference. Returns the color and hit distance.
+vec4 traceDda(vec3 ray_ori, vec3 ray_dir, float start_t)
+{
+	int resolution = 1 << MAX_DEPTH;
+
+	ivec3 base;
+	vec3 origin;
+	cellOrigin(ray_ori, base, origin);
+	float t = start_t * float(resolution);
+	float lod_cone = lodCone();
+	ivec3 cell = base + ivec3(floor(origin + t*ray_dir));
+
+	vec3 color = vec3(0);
+	float hit_t = -1.0;
+
+	ivec3 node_cells[MAX_DEPTH + 1];
+	node_cells[0] = ivec3(0);
+	int depth = 0;
+
+	int i;
+	for (i = 0; i < NUM_STEPS; i++)
+	{
+		ivec3 local = 2 * (cell & (resolution - 1));
+		ivec3 offset = (local >> (MAX_DEPTH - depth)) & 1;
+		ivec4 node_info = ivec4(round(texelFetch(tex_indirect, 2*node_cells[depth] + offset, 0) * 255.0));
+
+		bool lod = isNode(node_info.w) && depth < MAX_DEPTH && float(resolution >> (depth + 1)) < lod_cone * t;
+
+		if (isNode(node_info.w) && depth < MAX_DEPTH && !lod)
+		{
+			depth++;
+			node_cells[depth] = node_info.xyz;
+		}
+		else if (node_info.w == INDIRECT_LEAF || (lod && lodSolid(node_info.w)))
+		{
+			hit_t = t / float(resolution);
+			color = vec3(1,0,0) * smoothstep(4,0,hit_t);
+			break;
+		}
+		else
+		{
+			ivec3 prev_cell = cell;
+			exitNode(base, origin, ray_dir, max(1, resolution >> (depth + 1)), t, cell);
+
+			// the highest differing bit is the level where the cells part,
+			// bits above the tree's are another repetition of the octree
+			ivec3 diff = prev_cell ^ cell;
+			int bits = diff.x | diff.y | diff.z;
+			depth = (bits & ~(resolution - 1)) != 0 ? 0 : min(depth, MAX_DEPTH - 1 - findMSB(bits));
+		}
+	}
+	return vec4(color, hit_t);
+}
+#endif
 
 void main() 
 {
@@ -42,11 +235,20 @@ void main()
 	vec3 s = sign(ray_dir);
 
 	vec3 start = ray_ori;
+#ifdef BEAM
+	ray_ori += imageLoad(beam_image, ivec2(gl_FragCoord.xy) / BEAM_BLOCK).x * ray_dir;
+#endif
+#ifdef STACKLESS
+	out_color = vec4(traceStackless(start, ray_dir, length(ray_ori - start)).rgb, 1.0);
+	return;
+#endif
+#ifdef DDA
+	out_color = vec4(traceDda(start, ray_dir, length(ray_ori - start)).rgb, 1.0);
+	return;
+#endif
 
 	vec3 color = vec3(0);
-	const int MAX_DEPTH = 5;
-	const float MIN_VOXEL_SIZE = 1.0/pow(2,MAX_DEPTH); 
-	const int NUM_STEPS = 512;
+	float MIN_VOXEL_SIZE = 1.0/float(1 << MAX_DEPTH);
 	float tot_len = 0.0;
 
 	float voxel_size = 0.5;
@@ -54,8 +256,8 @@ void main()
 	bool exitoctree = false;
 	int depth = 0;
 	ivec3 current_cell = ivec3(0);
-	ivec3 cells_stack[MAX_DEPTH];
-	vec3 centers_stack[MAX_DEPTH];
+	ivec3 cells_stack[MAX_DEPTH + 1];
+	vec3 centers_stack[MAX_DEPTH + 1];
 	vec3 center = vec3(0.5);
 
 	int i;
@@ -81,7 +283,7 @@ void main()
 			vec4 res = texelFetch(tex_indirect, 2*current_cell + offset, 0);
 			ivec4 node_info = ivec4(round(res * 255.0));
 				
-			if (node_info.w == INDIRECT_NODE && depth <= MAX_DEPTH)
+			if (isNode(node_info.w) && depth <= MAX_DEPTH)
 			{
 				//color = vec3(0,0,1);
 				centers_stack[depth] = center;
@@ -129,6 +331,5 @@ void main()
 			}
 		}
 	}
-	//color = vec3(float(i)/NUM_STEPS);
     out_color = vec4(color, 1.0);
 }
@@ -2,6 +2,9 @@
 #extension GL_KHR_vulkan_glsl : enable
 #extension GL_ARB_separate_shader_objects : enable
 
+// width / height of the output, set by the renderer
+layout(constant_id = 0) const float ASPECT = 16.0 / 9.0;
+
 layout(location = 0) out vec2 out_uv;
 layout(location = 1) out vec3 out_ray_dir;
 
@@ -26,9 +29,8 @@ void main()
 	vec3 side = normalize(cross(up, cam_dir));
 	vec3 cam_up = normalize(cross(side, cam_dir));
 
-	float aspect = 16./9.;
 	vec2 pos = positions[gl_VertexIndex];
-	out_ray_dir = cam_dir + aspect*pos.x*side + pos.y*cam_up;
+	out_ray_dir = cam_dir + ASPECT*pos.x*side + pos.y*cam_up;
 
 	out_uv = pos*0.5 + 0.5;
     gl_Position = vec4(pos, 0.0, 1.0);
@@ -0,0 +1,32 @@
+#include "camera.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+glm::vec3 Camera::direction() const
+{
+    glm::vec3 dir = glm::quat(glm::vec3(0, yaw, 0)) *
+                    glm::quat(glm::vec3(0, 0, pitch)) * glm::vec3(1, 0, 0);
+    return glm::normalize(dir);
+}
+
+glm::vec3 Camera::rayDir(glm::vec2 ndc, float aspect) const
+{
+    glm::vec3 cam_dir = direction();
+    glm::vec3 side = glm::normalize(glm::cross(glm::vec3(0, 1, 0), cam_dir));
+    glm::vec3 cam_up = glm::normalize(glm::cross(side, cam_dir));
+    return cam_dir + aspect * ndc.x * side + ndc.y * cam_up;
+}
+
+bool Camera::project(glm::vec3 point, float aspect, glm::vec2& ndc) const
+{
+    glm::vec3 cam_dir = direction();
+    glm::vec3 side = glm::normalize(glm::cross(glm::vec3(0, 1, 0), cam_dir));
+    glm::vec3 cam_up = glm::normalize(glm::cross(side, cam_dir));
+
+    glm::vec3 v = point - position;
+    float z = glm::dot(v, cam_dir);
+    if (z <= 0.f) return false;
+
+    ndc = glm::vec2(glm::dot(v, side) / aspect, glm::dot(v, cam_up)) / z;
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Camera state shared by the Vulkan renderer and the CPU reference renderer
+struct Camera
+{
+    glm::vec3 position{ 0 };
+    float yaw = 0;
+    float pitch = 0;
+
+    glm::vec3 direction() const;
+
+    // Unnormalized ray direction through ndc in [-1, 1], y pointing down,
+    // same as shader.vert
+    glm::vec3 rayDir(glm::vec2 ndc, float aspect) const;
+
+    // Inverse of rayDir, the ndc the point is seen at. False if it is not
+    // in front of the camera.
+    bool project(glm::vec3 point, float aspect, glm::vec2& ndc) const;
+};
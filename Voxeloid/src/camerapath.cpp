@@ -0,0 +1,102 @@
+#include "camerapath.hpp"
+
+#include "util/runtimeerror.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+void CameraPath::addKeyframe(float time, const Camera& camera)
+{
+    if (!keyframes.empty() && time < keyframes.back().time)
+    {
+        THROW_RUNTIME_ERROR("Keyframes must be added in increasing time");
+    }
+    keyframes.push_back({ time, camera });
+}
+
+Camera CameraPath::sample(float time) const
+{
+    if (keyframes.empty()) return Camera();
+
+    auto next = std::upper_bound(
+        keyframes.begin(), keyframes.end(), time,
+        [](float t, const Keyframe& keyframe) { return t < keyframe.time; });
+    if (next == keyframes.begin()) return keyframes.front().camera;
+    if (next == keyframes.end()) return keyframes.back().camera;
+
+    const Keyframe& prev = *(next - 1);
+    float span = next->time - prev.time;
+    float a = span > 0.f ? (time - prev.time) / span : 1.f;
+
+    // yaw is not wrapped while recording, so plain lerp takes the short way
+    Camera camera;
+    camera.position = glm::mix(prev.camera.position, next->camera.position, a);
+    camera.yaw = glm::mix(prev.camera.yaw, next->camera.yaw, a);
+    camera.pitch = glm::mix(prev.camera.pitch, next->camera.pitch, a);
+    return camera;
+}
+
+float CameraPath::duration() const
+{
+    if (keyframes.empty()) return 0.f;
+    return keyframes.back().time - keyframes.front().time;
+}
+
+uint32_t CameraPath::frameCount(float timestep) const
+{
+    if (keyframes.empty()) return 0;
+    // the epsilon keeps a last keyframe on the timestep grid
+    return uint32_t(duration() / timestep + 1e-3f) + 1;
+}
+
+void CameraPath::save(const std::string& filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    file << "# time x y z yaw pitch\n";
+    file.precision(9);
+    for (auto& keyframe : keyframes)
+    {
+        const Camera& camera = keyframe.camera;
+        file << keyframe.time << " " << camera.position.x << " "
+             << camera.position.y << " " << camera.position.z << " "
+             << camera.yaw << " " << camera.pitch << "\n";
+    }
+}
+
+CameraPath CameraPath::load(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    CameraPath path;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream stream(line);
+        float time;
+        Camera camera;
+        if (!(stream >> time >> camera.position.x >> camera.position.y >>
+              camera.position.z >> camera.yaw >> camera.pitch))
+        {
+            THROW_RUNTIME_ERROR("Bad keyframe in '" + filename + "': " + line);
+        }
+        path.addKeyframe(time, camera);
+    }
+
+    if (path.empty())
+    {
+        THROW_RUNTIME_ERROR("No keyframes in: '" + filename + "'");
+    }
+    return path;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "camera.hpp"
+
+#include <string>
+#include <vector>
+
+// Camera keyframes over time, recorded from live input and played back
+// with a fixed timestep so that benchmark runs render the same frames
+class CameraPath
+{
+  public:
+    // keyframes must be added in increasing time
+    void addKeyframe(float time, const Camera& camera);
+
+    // Linear interpolation between the surrounding keyframes, clamped to
+    // the first and last keyframe
+    Camera sample(float time) const;
+
+    bool empty() const { return keyframes.empty(); }
+    float duration() const;
+    // frames needed to play the whole path with the given timestep
+    uint32_t frameCount(float timestep) const;
+
+    // one keyframe per line: time x y z yaw pitch
+    void save(const std::string& filename) const;
+    static CameraPath load(const std::string& filename);
+
+  private:
+    struct Keyframe
+    {
+        float time;
+        Camera camera;
+    };
+
+    std::vector<Keyframe> keyframes;
+};
@@ -0,0 +1,678 @@
+#include "cpurenderer.hpp"
+
+#include "util/lodepng.h"
+#include "util/profiler.hpp"
+#include "util/runtimeerror.hpp"
+#include "util/timer.hpp"
+
+#include <atomic>
+#include <future>
+#include <glm/integer.hpp>
+#include <thread>
+
+namespace
+{
+glm::vec3 glslMod(glm::vec3 x, float y) { return x - y * glm::floor(x / y); }
+
+} // namespace
+
+CpuRenderer::CpuRenderer(VoxelOctree& voxels)
+    : voxels(voxels), indirect_texture(voxels.getIndirectTexture().data()),
+      tex_side_length(int(voxels.getIndirectSize())),
+      max_depth(voxels.getDepth())
+{
+}
+
+glm::ivec4 CpuRenderer::texelFetch(glm::ivec3 cell)
+{
+    size_t index = 4 * (cell.x + size_t(cell.y) * tex_side_length +
+                        size_t(cell.z) * tex_side_length * tex_side_length);
+    return { indirect_texture[index + 0], indirect_texture[index + 1],
+             indirect_texture[index + 2], indirect_texture[index + 3] };
+}
+
+// Line by line port of main() in shader.frag
+glm::vec4 CpuRenderer::trace(glm::vec3 ray_ori, glm::vec3 ray_dir,
+                             float start_t, TraversalCost& cost)
+{
+    glm::vec3 s = glm::sign(ray_dir);
+
+    glm::vec3 start = ray_ori;
+    ray_ori += start_t * ray_dir;
+
+    glm::vec3 color = glm::vec3(0);
+    float hit_t = -1.f;
+    const float MIN_VOXEL_SIZE = 1.f / glm::pow(2.f, float(max_depth));
+
+    float voxel_size = 0.5f;
+
+    bool exitoctree = false;
+    int depth = 0;
+    glm::ivec3 current_cell = glm::ivec3(0);
+    glm::ivec3 cells_stack[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+    glm::vec3 centers_stack[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+    glm::vec3 center = glm::vec3(0.5f);
+
+    int i;
+    for (i = 0; i < NUM_STEPS; i++)
+    {
+        if (exitoctree)
+        {
+            depth--;
+
+            current_cell = cells_stack[depth];
+            center = centers_stack[depth];
+
+            voxel_size *= 2.f;
+
+            float vsize2 = voxel_size * 2.f;
+            glm::vec3 vpos2 = vsize2 * (glm::floor(ray_ori / vsize2) + 0.5f);
+            glm::vec3 new_vpos2 =
+                vsize2 * (glm::floor((ray_ori + vsize2) / vsize2) + 0.5f);
+            exitoctree = vpos2 != new_vpos2 && (depth > 0);
+        }
+        else
+        {
+            // check current voxel at f_ray_ori
+            glm::vec3 local_ori = glslMod(ray_ori, 1.f);
+            glm::ivec3 offset = glm::ivec3(glm::lessThan(center, local_ori));
+            glm::ivec4 node_info = texelFetch(2 * current_cell + offset);
+            cost.fetches++;
+            cost.max_depth = glm::max(cost.max_depth, depth);
+
+            if (isNode(node_info.w) && depth <= max_depth)
+            {
+                centers_stack[depth] = center;
+                cells_stack[depth] = current_cell;
+
+                depth++;
+                voxel_size *= 0.5f;
+
+                current_cell = glm::ivec3(node_info);
+                center += voxel_size * glm::vec3(offset * 2 - 1);
+            }
+            else if (node_info.w == INDIRECT_LEAF)
+            {
+                hit_t = glm::length(start - ray_ori);
+                color = glm::vec3(1, 0, 0) * glm::smoothstep(4.f, 0.f, hit_t);
+                break;
+            }
+            else
+            {
+                glm::vec3 vpos =
+                    voxel_size * (glm::floor(ray_ori / voxel_size) + 0.5f);
+                glm::vec3 hit =
+                    (vpos + 0.5f * voxel_size * s - ray_ori) / ray_dir;
+
+                glm::vec3 hit_yzx{ hit.y, hit.z, hit.x };
+                glm::vec3 hit_zxy{ hit.z, hit.x, hit.y };
+                glm::bvec3 mask =
+                    glm::lessThan(hit, glm::min(hit_yzx, hit_zxy));
+                float t = 0;
+                if (mask.x)
+                    t += hit.x;
+                else if (mask.y)
+                    t += hit.y;
+                else
+                    t += hit.z;
+
+                glm::vec3 new_ray_ori =
+                    ray_ori + (t + 0.01f * MIN_VOXEL_SIZE) * ray_dir;
+
+                float vsize2 = voxel_size * 2.f;
+                glm::vec3 vpos2 =
+                    vsize2 * (glm::floor(ray_ori / vsize2) + 0.5f);
+                glm::vec3 new_vpos2 =
+                    vsize2 * (glm::floor(new_ray_ori / vsize2) + 0.5f);
+
+                exitoctree = vpos2 != new_vpos2 && (depth > 0);
+
+                ray_ori = new_ray_ori;
+            }
+        }
+    }
+    cost.steps = i;
+    return glm::vec4(color, hit_t);
+}
+
+// Port of the STACKLESS variant of shader.frag. The ray is tracked by the
+// integer coordinates of the finest cell it is in, counted from the origin
+// of the repeated octree. Every node lookup descends from the root along
+// the bits of the cell, an empty node is left through the exact plane its
+// box exits at, and the cell on the other side is the next one looked up.
+glm::vec4 CpuRenderer::traceStackless(glm::vec3 ray_ori, glm::vec3 ray_dir,
+                                      float start_t, TraversalCost& cost)
+{
+    const int resolution = 1 << max_depth;
+
+    glm::ivec3 base;
+    glm::vec3 origin;
+    cellOrigin(ray_ori, base, origin);
+    // in finest cells like the origin
+    float t = start_t * float(resolution);
+    glm::ivec3 cell = base + glm::ivec3(glm::floor(origin + t * ray_dir));
+
+    glm::vec3 color = glm::vec3(0);
+    float hit_t = -1.f;
+
+    int i = 0;
+    while (i < NUM_STEPS)
+    {
+        // Solid finest voxels are nodes whose cell is all leaves, so the
+        // lookups go one level deeper than the cells, with offset 0 there
+        glm::ivec3 local = 2 * (cell & (resolution - 1));
+        glm::ivec3 node_cell = glm::ivec3(0);
+        int depth = 0;
+        glm::ivec4 node_info;
+        bool lod = false;
+        // one lookup per step, like the stack traversal
+        for (; i < NUM_STEPS; i++)
+        {
+            glm::ivec3 offset = (local >> (max_depth - depth)) & 1;
+            node_info = texelFetch(2 * node_cell + offset);
+            cost.fetches++;
+            cost.max_depth = glm::max(cost.max_depth, depth);
+            if (!isNode(node_info.w) || depth == max_depth) break;
+            lod = float(resolution >> (depth + 1)) < lod_cone * t;
+            if (lod) break;
+            node_cell = glm::ivec3(node_info);
+            depth++;
+        }
+        if (i == NUM_STEPS) break;
+        i++;
+
+        if (node_info.w == INDIRECT_LEAF ||
+            (lod && occupancy(node_info.w) >= LOD_MIN_OCCUPANCY))
+        {
+            hit_t = t / float(resolution);
+            color = glm::vec3(1, 0, 0) * glm::smoothstep(4.f, 0.f, hit_t);
+            break;
+        }
+
+        // the empty child of the last lookup, size in finest cells
+        exitNode(base, origin, ray_dir, glm::max(1, resolution >> (depth + 1)),
+                 t, cell);
+    }
+    cost.steps = i;
+    return glm::vec4(color, hit_t);
+}
+
+// Port of the DDA variant of shader.frag. Like the stackless traversal
+// the ray is tracked by its finest cell and leaves empty nodes through
+// their exact planes, but the texture cells of the nodes above it are kept.
+// The cell after an exit shares the high bits of the one before down to
+// their deepest common node, the lookups resume from there.
+glm::vec4 CpuRenderer::traceDda(glm::vec3 ray_ori, glm::vec3 ray_dir,
+                                float start_t, TraversalCost& cost)
+{
+    const int resolution = 1 << max_depth;
+
+    glm::ivec3 base;
+    glm::vec3 origin;
+    cellOrigin(ray_ori, base, origin);
+    // in finest cells like the origin
+    float t = start_t * float(resolution);
+    glm::ivec3 cell = base + glm::ivec3(glm::floor(origin + t * ray_dir));
+
+    glm::vec3 color = glm::vec3(0);
+    float hit_t = -1.f;
+
+    // the texture cell of the node looked up at each depth
+    glm::ivec3 node_cells[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+    node_cells[0] = glm::ivec3(0);
+    int depth = 0;
+
+    int i;
+    for (i = 0; i < NUM_STEPS; i++)
+    {
+        // the lookups go one level deeper than the cells, like stackless
+        glm::ivec3 local = 2 * (cell & (resolution - 1));
+        glm::ivec3 offset = (local >> (max_depth - depth)) & 1;
+        glm::ivec4 node_info = texelFetch(2 * node_cells[depth] + offset);
+        cost.fetches++;
+        cost.max_depth = glm::max(cost.max_depth, depth);
+
+        // nodes smaller than the pixel cone are not descended into
+        bool lod = isNode(node_info.w) && depth < max_depth &&
+                   float(resolution >> (depth + 1)) < lod_cone * t;
+
+        if (isNode(node_info.w) && depth < max_depth && !lod)
+        {
+            node_cells[++depth] = glm::ivec3(node_info);
+        }
+        else if (node_info.w == INDIRECT_LEAF ||
+                 (lod && occupancy(node_info.w) >= LOD_MIN_OCCUPANCY))
+        {
+            hit_t = t / float(resolution);
+            color = glm::vec3(1, 0, 0) * glm::smoothstep(4.f, 0.f, hit_t);
+            break;
+        }
+        else
+        {
+            glm::ivec3 prev_cell = cell;
+            exitNode(base, origin, ray_dir,
+                     glm::max(1, resolution >> (depth + 1)), t, cell);
+
+            // The highest differing bit is the level where the cells part.
+            // Bits above the tree's are another repetition of the octree,
+            // which starts over at the root.
+            glm::ivec3 diff = prev_cell ^ cell;
+            int bits = diff.x | diff.y | diff.z;
+            if ((bits & ~(resolution - 1)) != 0)
+                depth = 0;
+            else
+                depth = glm::min(depth, max_depth - 1 - glm::findMSB(bits));
+        }
+    }
+    cost.steps = i;
+    return glm::vec4(color, hit_t);
+}
+
+// Scaling by a power of two and subtracting the integer part are exact,
+// only the accumulated origin + t * ray_dir rounds. Relative to base its
+// error grows with the distance travelled, like the size of a pixel,
+// instead of with the distance to the octree's origin.
+void CpuRenderer::cellOrigin(glm::vec3 ray_ori, glm::ivec3& base,
+                             glm::vec3& origin)
+{
+    glm::vec3 scaled = ray_ori * float(1 << max_depth);
+    base = deep_precision ? glm::ivec3(glm::floor(scaled)) : glm::ivec3(0);
+    origin = scaled - glm::vec3(base);
+}
+
+void CpuRenderer::exitNode(glm::ivec3 base, glm::vec3 origin,
+                           glm::vec3 ray_dir, int size, float& t,
+                           glm::ivec3& cell)
+{
+    const glm::ivec3 positive = glm::ivec3(glm::greaterThan(ray_dir,
+                                                            glm::vec3(0)));
+
+    glm::ivec3 node_min = cell & ~(size - 1);
+    glm::vec3 exit_plane = glm::vec3(node_min + positive * size - base);
+    glm::vec3 exit_t = (exit_plane - origin) * (1.f / ray_dir);
+    // parallel axes never exit
+    exit_t = glm::mix(exit_t, glm::vec3(INFINITY),
+                      glm::equal(ray_dir, glm::vec3(0)));
+
+    int axis = exit_t.x < exit_t.y ? (exit_t.x < exit_t.z ? 0 : 2)
+                                   : (exit_t.y < exit_t.z ? 1 : 2);
+    t = glm::max(t, exit_t[axis]);
+
+    // the exit point can cross other planes at a corner, it is only kept
+    // from rounding back behind the node
+    glm::ivec3 next = base + glm::ivec3(glm::floor(origin + t * ray_dir));
+    cell = glm::mix(glm::min(next, node_min + size - 1),
+                    glm::max(next, node_min), glm::bvec3(positive));
+    cell[axis] = positive[axis] ? node_min[axis] + size : node_min[axis] - 1;
+}
+
+glm::vec4 CpuRenderer::reconstruct(const std::vector<glm::vec4>& current,
+                                   const Camera& camera, glm::ivec2 pixel,
+                                   glm::vec3 ray_dir, glm::ivec2 size,
+                                   float aspect)
+{
+    // the four neighbors were traced this frame
+    const glm::ivec2 neighbors[4] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    glm::vec3 color{ 0 };
+    glm::vec3 color_min{ 1 };
+    glm::vec3 color_max{ 0 };
+    float depth_sum = 0.f;
+    float depth_min = 0.f;
+    float depth_max = 0.f;
+    int count = 0;
+    int hits = 0;
+    for (glm::ivec2 offset : neighbors)
+    {
+        glm::ivec2 p = pixel + offset;
+        if (glm::any(glm::lessThan(p, glm::ivec2(0))) ||
+            glm::any(glm::greaterThanEqual(p, size)))
+        {
+            continue;
+        }
+        glm::vec4 sample = current[size_t(p.y) * size.x + p.x];
+        color += glm::vec3(sample);
+        color_min = glm::min(color_min, glm::vec3(sample));
+        color_max = glm::max(color_max, glm::vec3(sample));
+        count++;
+        if (sample.w >= 0.f)
+        {
+            depth_min = hits == 0 ? sample.w : glm::min(depth_min, sample.w);
+            depth_max = hits == 0 ? sample.w : glm::max(depth_max, sample.w);
+            depth_sum += sample.w;
+            hits++;
+        }
+    }
+
+    // Spatial fallback for the first frame, silhouettes and disocclusions
+    glm::vec4 spatial(color / float(count),
+                      hits == count ? depth_sum / float(hits) : -1.f);
+    if (history.empty() || hits == 0 || hits < count ||
+        depth_max - depth_min > DEPTH_TOLERANCE * depth_min)
+    {
+        return spatial;
+    }
+
+    glm::vec3 world = camera.position + spatial.w * ray_dir;
+    glm::vec2 ndc;
+    if (!prev_camera.project(world, aspect, ndc)) return spatial;
+
+    glm::ivec2 prev_pixel =
+        glm::ivec2(glm::floor((0.5f * ndc + 0.5f) * glm::vec2(size)));
+    if (glm::any(glm::lessThan(prev_pixel, glm::ivec2(0))) ||
+        glm::any(glm::greaterThanEqual(prev_pixel, size)))
+    {
+        return spatial;
+    }
+
+    // the surface seen there last frame has to be the same one
+    glm::vec4 prev = history[size_t(prev_pixel.y) * size.x + prev_pixel.x];
+    float prev_depth = glm::length(world - prev_camera.position);
+    if (prev.w < 0.f ||
+        glm::abs(prev.w - prev_depth) > DEPTH_TOLERANCE * prev.w)
+    {
+        return spatial;
+    }
+    // clamped to the neighbors against ghosting, like temporal AA
+    return glm::vec4(glm::clamp(glm::vec3(prev), color_min, color_max),
+                     spatial.w);
+}
+
+// Depth first over the nodes overlapping the box, like shaders/beam.comp
+bool CpuRenderer::isEmpty(glm::vec3 box_min, glm::vec3 box_max)
+{
+    glm::ivec3 cells[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+    glm::vec3 mins[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+    int next_child[VoxelOctree::MAX_SUPPORTED_DEPTH + 1];
+
+    int depth = 0;
+    cells[0] = glm::ivec3(0);
+    mins[0] = glm::vec3(0);
+    next_child[0] = 0;
+
+    int visits = 0;
+    while (depth >= 0)
+    {
+        if (next_child[depth] == 8)
+        {
+            depth--;
+            continue;
+        }
+        int child = next_child[depth];
+        next_child[depth] = child + 1;
+
+        if (++visits > MAX_VISITS) return false;
+
+        glm::ivec3 offset{ child & 1, (child >> 1) & 1, (child >> 2) & 1 };
+        float child_size = 0.5f / float(1 << depth);
+        glm::vec3 child_min = mins[depth] + child_size * glm::vec3(offset);
+
+        // touching counts as overlapping
+        if (glm::any(glm::lessThan(box_max, child_min)) ||
+            glm::any(glm::lessThan(child_min + child_size, box_min)))
+        {
+            continue;
+        }
+
+        glm::ivec4 node_info = texelFetch(2 * cells[depth] + offset);
+        if (node_info.w == INDIRECT_LEAF) return false;
+        if (node_info.w != INDIRECT_EMPTY)
+        {
+            if (depth == max_depth) return false;
+            depth++;
+            cells[depth] = glm::ivec3(node_info);
+            mins[depth] = child_min;
+            next_child[depth] = 0;
+        }
+    }
+    return true;
+}
+
+bool CpuRenderer::isEmptyRepeated(glm::vec3 box_min, glm::vec3 box_max)
+{
+    glm::ivec3 first = glm::ivec3(glm::floor(box_min));
+    glm::ivec3 last = glm::ivec3(glm::floor(box_max));
+    for (int z = first.z; z <= last.z; z++)
+    {
+        for (int y = first.y; y <= last.y; y++)
+        {
+            for (int x = first.x; x <= last.x; x++)
+            {
+                glm::vec3 tile = glm::vec3(x, y, z);
+                if (!isEmpty(glm::max(box_min, tile) - tile,
+                             glm::min(box_max, tile + 1.f) - tile))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Same march as shaders/beam.comp. The cone segment between t and t + step
+// lies in the box around the cross sections at both ends, the step grows
+// while these boxes are empty and shrinks down to the finest voxel size
+// when they are not.
+float CpuRenderer::beamDistance(glm::vec3 origin, glm::vec3 dir,
+                                float tan_half, int& steps)
+{
+    const float MIN_STEP = 1.f / glm::pow(2.f, float(max_depth));
+
+    float t = 0.f;
+    float step = 0.125f;
+    for (steps = 0; steps < BEAM_STEPS && t < BEAM_MAX_DISTANCE; steps++)
+    {
+        float next_t = t + step;
+        glm::vec3 p0 = origin + t * dir;
+        glm::vec3 p1 = origin + next_t * dir;
+        float r0 = t * tan_half;
+        float r1 = next_t * tan_half;
+
+        if (isEmptyRepeated(glm::min(p0 - r0, p1 - r1),
+                            glm::max(p0 + r0, p1 + r1)))
+        {
+            t = next_t;
+            step = glm::min(2.f * step, 0.5f);
+        }
+        else if (step > MIN_STEP)
+        {
+            step *= 0.5f;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return glm::min(t, BEAM_MAX_DISTANCE);
+}
+
+RenderStats CpuRenderer::render(const Camera& camera, uint32_t width,
+                                uint32_t height, std::vector<uint8_t>& rgba)
+{
+    PROFILE_SCOPE("CpuRenderer::render");
+
+    rgba.resize(size_t(width) * height * 4);
+
+    uint32_t tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t num_tiles = tiles_x * tiles_y;
+    float aspect = float(width) / float(height);
+
+    // start distance of every beam block, all zero without the prepass
+    uint32_t block = beam_block > 0 ? beam_block : width;
+    uint32_t blocks_x = (width + block - 1) / block;
+    uint32_t blocks_y = (height + block - 1) / block;
+    std::vector<float> beam_distances(size_t(blocks_x) * blocks_y, 0.f);
+
+    std::atomic<uint32_t> next_block{ 0 };
+    auto beam_worker = [&]() {
+        PROFILE_SCOPE("beam prepass");
+        uint64_t steps = 0;
+        for (uint32_t b = next_block++; b < blocks_x * blocks_y;
+             b = next_block++)
+        {
+            glm::uvec2 b0{ (b % blocks_x) * block, (b / blocks_x) * block };
+            glm::uvec2 b1 = glm::min(b0 + block, glm::uvec2(width, height));
+            glm::vec2 size = glm::vec2(width, height);
+
+            // the cone around the block's center ray through its corners
+            // holds all of its rays
+            glm::vec3 dir = glm::normalize(camera.rayDir(
+                glm::vec2(b0 + b1) / size - 1.f, aspect));
+            float cos_half = 1.f;
+            for (int corner = 0; corner < 4; corner++)
+            {
+                glm::vec2 pixel = glm::vec2(corner & 1 ? b1.x : b0.x,
+                                            corner & 2 ? b1.y : b0.y);
+                glm::vec3 corner_dir = glm::normalize(
+                    camera.rayDir(2.f * pixel / size - 1.f, aspect));
+                cos_half = glm::min(cos_half, glm::dot(dir, corner_dir));
+            }
+            float tan_half =
+                1.001f * glm::sqrt(glm::max(0.f, 1.f - cos_half * cos_half)) /
+                cos_half;
+
+            int cone_steps = 0;
+            beam_distances[b] =
+                beamDistance(camera.position, dir, tan_half, cone_steps);
+            steps += cone_steps;
+        }
+        return steps;
+    };
+
+    if (history.size() != size_t(width) * height)
+    {
+        history.clear();
+    }
+    // color and hit distance of every pixel of this frame
+    std::vector<glm::vec4> current(size_t(width) * height);
+
+    // Pass 0 traces the pixels, only the ones where x + y + frame is even
+    // with the checkerboard. Pass 1 reconstructs the others from them.
+    std::atomic<uint32_t> next_tile{ 0 };
+    auto worker = [&](int pass) {
+        PROFILE_SCOPE("render tiles");
+        RenderStats tile_stats;
+        for (uint32_t tile = next_tile++; tile < num_tiles; tile = next_tile++)
+        {
+            uint32_t x0 = (tile % tiles_x) * TILE_SIZE;
+            uint32_t y0 = (tile / tiles_x) * TILE_SIZE;
+            for (uint32_t y = y0; y < glm::min(y0 + TILE_SIZE, height); y++)
+            {
+                for (uint32_t x = x0; x < glm::min(x0 + TILE_SIZE, width); x++)
+                {
+                    bool traced = !checkerboard || ((x + y + frame) & 1) == 0;
+                    if (traced != (pass == 0)) continue;
+
+                    // pixel centers, like the interpolated fragment inputs
+                    glm::vec2 ndc = 2.f * (glm::vec2(x, y) + 0.5f) /
+                                        glm::vec2(width, height) -
+                                    1.f;
+                    glm::vec3 ray_dir =
+                        glm::normalize(camera.rayDir(ndc, aspect));
+
+                    size_t pixel = size_t(y) * width + x;
+                    if (traced)
+                    {
+                        float start_t =
+                            beam_distances[(y / block) * blocks_x + x / block];
+
+                        TraversalCost cost;
+                        if (traversal == Traversal::Stackless)
+                        {
+                            current[pixel] = traceStackless(
+                                camera.position, ray_dir, start_t, cost);
+                        }
+                        else if (traversal == Traversal::Dda)
+                        {
+                            current[pixel] = traceDda(camera.position,
+                                                      ray_dir, start_t, cost);
+                        }
+                        else
+                        {
+                            current[pixel] = trace(camera.position, ray_dir,
+                                                   start_t, cost);
+                        }
+                        tile_stats.steps += cost.steps;
+                        tile_stats.rays++;
+                        if (heatmap != HeatmapMetric::None)
+                        {
+                            // the hit distance stays for the checkerboard
+                            current[pixel] = glm::vec4(
+                                heatmapColor(cost, heatmap, max_depth),
+                                current[pixel].w);
+                            tile_stats.costs.add(cost);
+                        }
+                    }
+                    else
+                    {
+                        current[pixel] = reconstruct(
+                            current, camera, glm::ivec2(x, y), ray_dir,
+                            glm::ivec2(width, height), aspect);
+                    }
+
+                    glm::vec3 unorm = glm::round(
+                        255.f *
+                        glm::clamp(glm::vec3(current[pixel]), 0.f, 1.f));
+                    rgba[4 * pixel + 0] = uint8_t(unorm.r);
+                    rgba[4 * pixel + 1] = uint8_t(unorm.g);
+                    rgba[4 * pixel + 2] = uint8_t(unorm.b);
+                    rgba[4 * pixel + 3] = 255;
+                }
+            }
+        }
+        return tile_stats;
+    };
+
+    // a pixel spans 2 / height at unit distance along the camera's
+    // direction, see Camera::rayDir
+    lod_cone = lod_scale * 2.f / float(height);
+
+    Timer timer;
+    RenderStats stats;
+    std::vector<std::future<uint64_t>> futures;
+    unsigned num_threads = glm::max(1U, std::thread::hardware_concurrency());
+    if (beam_block > 0)
+    {
+        for (unsigned i = 0; i < num_threads; i++)
+            futures.push_back(std::async(std::launch::async, beam_worker));
+        for (auto& future : futures)
+            stats.beam_steps += future.get();
+        futures.clear();
+    }
+
+    for (int pass = 0; pass < (checkerboard ? 2 : 1); pass++)
+    {
+        next_tile = 0;
+        std::vector<std::future<RenderStats>> tile_futures;
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            tile_futures.push_back(
+                std::async(std::launch::async, worker, pass));
+        }
+        for (auto& future : tile_futures)
+        {
+            RenderStats tile_stats = future.get();
+            stats.steps += tile_stats.steps;
+            stats.rays += tile_stats.rays;
+            stats.costs.add(tile_stats.costs);
+        }
+    }
+    stats.seconds = timer.Restart();
+
+    history.swap(current);
+    prev_camera = camera;
+    frame++;
+    return stats;
+}
+
+void CpuRenderer::writePNG(const std::string& filename,
+                           const std::vector<uint8_t>& rgba, uint32_t width,
+                           uint32_t height)
+{
+    unsigned error = lodepng::encode(filename, rgba, width, height);
+    if (error)
+    {
+        THROW_RUNTIME_ERROR("Failed to write '" + filename +
+                            "': " + lodepng_error_text(error));
+    }
+}
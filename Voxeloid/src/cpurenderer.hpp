@@ -0,0 +1,172 @@
+#pragma once
+
+#include "camera.hpp"
+#include "traversalcost.hpp"
+#include "voxeloctree.hpp"
+
+#include <string>
+#include <vector>
+
+struct RenderStats
+{
+    double seconds = 0;
+    // traced rays, pixels reconstructed by the checkerboard don't count
+    uint64_t rays = 0;
+    uint64_t steps = 0;
+    // cone steps of the beam prepass
+    uint64_t beam_steps = 0;
+    // of the traced rays, only filled in heatmap mode
+    CostHistogram costs;
+
+    double raysPerSecond() const { return rays / seconds; }
+    double stepsPerRay() const { return double(steps) / rays; }
+    double beamStepsPerRay() const { return double(beam_steps) / rays; }
+};
+
+// Reference renderer running the traversal of shader.frag on the CPU, with
+// the camera rays of shader.vert. Tiles are rendered in parallel on all
+// hardware threads.
+class CpuRenderer
+{
+  public:
+    CpuRenderer(VoxelOctree& voxels);
+
+    // Beam prepass like shaders/beam.comp: a cone around the rays of each
+    // block x block pixels is marched through empty space first, and the
+    // rays of the block start where it touches a voxel. 0 turns it off.
+    void setBeamBlock(uint32_t block_size) { beam_block = block_size; }
+
+    // Checkerboard like the CHECKERBOARD variant of shaders/shader.comp:
+    // half the pixels are traced, the others are reprojected from the last
+    // frame rendered with it, or interpolated from their neighbors where
+    // that surface was not visible.
+    void setCheckerboard(bool enabled)
+    {
+        checkerboard = enabled;
+        history.clear();
+    }
+
+    void setTraversal(Traversal kind) { traversal = kind; }
+
+    // Like the DEEP shader variants: the integer traversals track the ray
+    // relative to the finest cell of its origin instead of the octree's
+    // origin, see cellOrigin. Floats resolve about 2^24 cells from the
+    // origin, so without it the cells of trees deeper than about 20
+    // levels come out wrong. The stack traversal ignores it.
+    void setDeepPrecision(bool enabled) { deep_precision = enabled; }
+
+    // Level of detail like the LOD_CONE of shaders/shader.frag: the integer
+    // traversals do not descend into nodes smaller than the cone of a pixel
+    // at their distance, scaled by 2^bias, and take them as solid when at
+    // least LOD_MIN_OCCUPANCY of their volume is. Positive biases stop
+    // earlier. The stack traversal ignores it.
+    void setLod(bool enabled, float bias = 0.f)
+    {
+        lod_scale = enabled ? glm::exp2(bias) : 0.f;
+    }
+
+    // Like the HEATMAP variant of shaders/shader.comp: traced pixels show
+    // the metric's heatmapColor instead of the shading, and the costs of
+    // their rays are collected in RenderStats::costs. None turns it off.
+    void setHeatmap(HeatmapMetric metric) { heatmap = metric; }
+
+    // rgba is resized to width * height * 4, rows top to bottom
+    RenderStats render(const Camera& camera, uint32_t width, uint32_t height,
+                       std::vector<uint8_t>& rgba);
+
+    static void writePNG(const std::string& filename,
+                         const std::vector<uint8_t>& rgba, uint32_t width,
+                         uint32_t height);
+
+    // color and hit distance of every pixel of the last render, -1 for
+    // misses
+    const std::vector<glm::vec4>& lastFrame() const { return history; }
+
+  private:
+    const static uint32_t TILE_SIZE = 16;
+    const static int NUM_STEPS = 512;
+
+    const static int INDIRECT_LEAF = 255;
+    const static int INDIRECT_EMPTY = 0;
+    // nodes are the values in between, see VoxelOctree
+    const static int INDIRECT_NODE_MIN = 1;
+    const static int INDIRECT_NODE_MAX = 254;
+
+    constexpr static float LOD_MIN_OCCUPANCY = 0.5f;
+
+    // shading fades to black at this distance, cones stop there
+    constexpr static float BEAM_MAX_DISTANCE = 4.f;
+    const static int BEAM_STEPS = 64;
+    // nodes visited by one box query before it gives up and reports a voxel
+    const static int MAX_VISITS = 1024;
+
+    // relative hit distance differences still on the same surface
+    constexpr static float DEPTH_TOLERANCE = 0.05f;
+
+    // Color and the hit distance in w, -1 for misses. The ray starts
+    // start_t along ray_dir, shading uses the distance to ray_ori.
+    glm::vec4 trace(glm::vec3 ray_ori, glm::vec3 ray_dir, float start_t,
+                    TraversalCost& cost);
+    glm::vec4 traceStackless(glm::vec3 ray_ori, glm::vec3 ray_dir,
+                             float start_t, TraversalCost& cost);
+    glm::vec4 traceDda(glm::vec3 ray_ori, glm::vec3 ray_dir, float start_t,
+                       TraversalCost& cost);
+
+    // The ray origin in finest cells as base + origin, both exact. base is
+    // the origin's cell with deep precision and 0 without, so origin is
+    // either within the cell or the whole position.
+    void cellOrigin(glm::vec3 ray_ori, glm::ivec3& base, glm::vec3& origin);
+
+    // Leaves the empty node of size finest cells around cell at the plane
+    // it exits through. t, in finest cells along ray_dir, moves to the
+    // exit, cell to the finest cell on the other side.
+    void exitNode(glm::ivec3 base, glm::vec3 origin, glm::vec3 ray_dir,
+                  int size, float& t, glm::ivec3& cell);
+
+    // color and hit distance of an untraced checkerboard pixel
+    glm::vec4 reconstruct(const std::vector<glm::vec4>& current,
+                          const Camera& camera, glm::ivec2 pixel,
+                          glm::vec3 ray_dir, glm::ivec2 size, float aspect);
+
+    // distance along dir up to which the cone with apex origin is empty
+    float beamDistance(glm::vec3 origin, glm::vec3 dir, float tan_half,
+                       int& steps);
+    // True if no voxel touches the box in [0, 1], the walk over the
+    // indirect texture of shaders/beam.comp, including its visit limit
+    bool isEmpty(glm::vec3 box_min, glm::vec3 box_max);
+    // box in the unit cube space of shader.frag, repeated along every axis
+    bool isEmptyRepeated(glm::vec3 box_min, glm::vec3 box_max);
+
+    glm::ivec4 texelFetch(glm::ivec3 cell);
+
+    static bool isNode(int node_info)
+    {
+        return node_info != INDIRECT_LEAF && node_info != INDIRECT_EMPTY;
+    }
+    // solid fraction of the volume of a node
+    static float occupancy(int node_info)
+    {
+        return float(node_info - INDIRECT_NODE_MIN) /
+               float(INDIRECT_NODE_MAX - INDIRECT_NODE_MIN);
+    }
+
+    VoxelOctree& voxels;
+    const uint8_t* indirect_texture;
+    int tex_side_length;
+    int max_depth;
+    uint32_t beam_block = 0;
+    Traversal traversal = Traversal::Stack;
+    bool deep_precision = false;
+    // 2^bias, 0 without level of detail
+    float lod_scale = 0.f;
+    // size of a node in finest cells below which it is not descended into,
+    // per finest cell of distance, set up by render
+    float lod_cone = 0.f;
+    HeatmapMetric heatmap = HeatmapMetric::None;
+
+    bool checkerboard = false;
+    uint32_t frame = 0;
+    Camera prev_camera;
+    // color and hit distance of the last frame
+    std::vector<glm::vec4> history;
+};
@@ -1,9 +1,16 @@
 #include "engine.hpp"
 
-void Engine::init() { renderer.init(); }
+#include "util/profiler.hpp"
+
+void Engine::init(const RenderOptions& options)
+{
+    renderer.init(options);
+}
 
 void Engine::update()
 {
+    PROFILE_SCOPE("frame");
+
     renderer.updateWindow();
     renderer.render();
 }
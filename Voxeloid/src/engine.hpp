@@ -5,7 +5,7 @@
 class Engine
 {
   public:
-    void init();
+    void init(const RenderOptions& options = {});
     void update();
     void cleanup();
 
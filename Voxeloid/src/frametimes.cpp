@@ -0,0 +1,25 @@
+#include "frametimes.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+double FrameTimes::percentile(double p) const
+{
+    if (times.empty()) return 0.0;
+
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = size_t(std::ceil(p * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void FrameTimes::printReport(std::ostream& out) const
+{
+    out << "frames: " << times.size() << "\n";
+    if (times.empty()) return;
+
+    out << "frame ms: min " << 1e3 * percentile(0.0) << "  p50 "
+        << 1e3 * percentile(0.5) << "  p95 " << 1e3 * percentile(0.95)
+        << "  p99 " << 1e3 * percentile(0.99) << "  max "
+        << 1e3 * percentile(1.0) << "\n";
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+// Per-frame durations of a benchmark run
+class FrameTimes
+{
+  public:
+    void add(double seconds) { times.push_back(seconds); }
+    size_t size() const { return times.size(); }
+
+    // p in [0, 1], nearest rank
+    double percentile(double p) const;
+
+    // frame count, min, p50, p95, p99 and max in milliseconds
+    void printReport(std::ostream& out) const;
+
+  private:
+    std::vector<double> times;
+};
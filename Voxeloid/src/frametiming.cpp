@@ -0,0 +1,99 @@
+#include "frametiming.hpp"
+
+#include "util/runtimeerror.hpp"
+
+#include <fstream>
+
+namespace
+{
+std::ofstream openOutput(const std::string& filename)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+    return file;
+}
+
+} // namespace
+
+FrameTiming& FrameTimingLog::push(uint64_t frame)
+{
+    FrameTiming& timing = entries[next];
+    timing = FrameTiming();
+    timing.frame = frame;
+
+    next = (next + 1) % CAPACITY;
+    if (count < CAPACITY) count++;
+    return timing;
+}
+
+FrameTiming* FrameTimingLog::find(uint64_t frame)
+{
+    // frames are pushed in order, so the offset from the newest is direct
+    if (count == 0) return nullptr;
+    const FrameTiming& newest = (*this)[count - 1];
+    if (frame > newest.frame || newest.frame - frame >= count) return nullptr;
+
+    size_t i = count - 1 - size_t(newest.frame - frame);
+    return &entries[(next + CAPACITY - count + i) % CAPACITY];
+}
+
+const FrameTiming& FrameTimingLog::operator[](size_t i) const
+{
+    return entries[(next + CAPACITY - count + i) % CAPACITY];
+}
+
+void FrameTimingLog::writeCSV(const std::string& filename) const
+{
+    std::ofstream file = openOutput(filename);
+    file << "frame,acquire_ms,fence_wait_ms,uniform_update_ms,submit_ms,"
+            "present_ms,gpu_ms,input_to_present_ms,input_to_gpu_done_ms,"
+            "render_scale\n";
+    for (size_t i = 0; i < count; i++)
+    {
+        const FrameTiming& t = (*this)[i];
+        file << t.frame << "," << t.acquire << "," << t.fence_wait << ","
+             << t.uniform_update << "," << t.submit << "," << t.present << ","
+             << t.gpu << "," << t.input_to_present << ","
+             << t.input_to_gpu_done << "," << t.render_scale << "\n";
+    }
+}
+
+void FrameTimingLog::writeJSON(const std::string& filename) const
+{
+    std::ofstream file = openOutput(filename);
+    file << "{\n  \"frames\": [\n";
+    for (size_t i = 0; i < count; i++)
+    {
+        const FrameTiming& t = (*this)[i];
+        file << "    {\"frame\": " << t.frame << ", \"acquire_ms\": "
+             << t.acquire << ", \"fence_wait_ms\": " << t.fence_wait
+             << ", \"uniform_update_ms\": " << t.uniform_update
+             << ", \"submit_ms\": " << t.submit
+             << ", \"present_ms\": " << t.present << ", \"gpu_ms\": ";
+        if (t.gpu < 0)
+            file << "null";
+        else
+            file << t.gpu;
+        file << ", \"input_to_present_ms\": " << t.input_to_present
+             << ", \"input_to_gpu_done_ms\": ";
+        if (t.input_to_gpu_done < 0)
+            file << "null";
+        else
+            file << t.input_to_gpu_done;
+        file << ", \"render_scale\": " << t.render_scale;
+        file << "}" << (i + 1 < count ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+}
+
+void FrameTimingLog::write(const std::string& filename) const
+{
+    size_t dot = filename.find_last_of('.');
+    if (dot != std::string::npos && filename.substr(dot) == ".json")
+        writeJSON(filename);
+    else
+        writeCSV(filename);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Where the time of one frame went, all durations in milliseconds
+struct FrameTiming
+{
+    uint64_t frame = 0;
+
+    double acquire = 0;
+    double fence_wait = 0;
+    double uniform_update = 0;
+    double submit = 0;
+    double present = 0;
+
+    // render pass on the GPU from timestamp queries, negative until the
+    // results are read back or when the queue has no timestamps
+    double gpu = -1;
+
+    // From sampling the input until present was queued, and until the GPU
+    // finished the render pass. The latter is the motion-to-photon latency
+    // without the wait for scanout, negative when not available.
+    double input_to_present = 0;
+    double input_to_gpu_done = -1;
+
+    // traced pixels per output pixel along each axis, below one with
+    // dynamic resolution
+    double render_scale = 1;
+};
+
+// The timings of the last CAPACITY frames, the oldest are overwritten
+class FrameTimingLog
+{
+  public:
+    constexpr static size_t CAPACITY = 1024;
+
+    // starts a new entry, overwriting the oldest when full
+    FrameTiming& push(uint64_t frame);
+    // null if the frame was already overwritten
+    FrameTiming* find(uint64_t frame);
+
+    size_t size() const { return count; }
+    // i = 0 is the oldest frame still stored
+    const FrameTiming& operator[](size_t i) const;
+
+    void writeCSV(const std::string& filename) const;
+    void writeJSON(const std::string& filename) const;
+    // picks the format from the extension, .json or anything else as CSV
+    void write(const std::string& filename) const;
+
+  private:
+    std::array<FrameTiming, CAPACITY> entries;
+    size_t next = 0;
+    size_t count = 0;
+};
@@ -1,26 +1,221 @@
 #include "engine.hpp"
+#include "util/profiler.hpp"
 #include "util/timer.hpp"
 #include "voxeloctree.hpp"
 
+#include <cstring>
 #include <iostream>
 
-int main()
+// Voxeloid [--scene file] [--size w h] [--pos x y z] [--yaw a] [--pitch a]
+//          [--headless] [--frames n] [--out file.png]
+//          [--record path.txt] [--play path.txt] [--timestep s]
+//          [--timings file.csv|file.json] [--trace file.json]
+//          [--compute] [--tile w h] [--beam] [--checkerboard]
+//          [--stackless] [--dda] [--deep] [--lod bias] [--budget ms]
+//          [--min-scale s] [--steps n] [--pipeline-cache file]
+//          [--heatmap steps|depth|fetches] [--heatmap-json file.json]
+// --headless renders n frames offscreen without a window and writes the
+// last one to --out, for benchmarks and image comparisons on machines
+// without a display. --play replaces the live input with a path saved by
+// --record and stops at its end. --compute traces in w x h tiles with the
+// compute shader, the gpu times of --timings compare it to the default
+// fragment shader. --beam adds the empty space skipping prepass to either.
+// --checkerboard traces half the pixels each frame with the compute shader.
+// --stackless swaps the traversal of either shader for the one without a
+// node stack, --dda for the one stepping through integer cells. --deep
+// keeps either precise in trees deeper than about 20 levels. --lod stops
+// either at nodes smaller than a pixel times 2^bias.
+// --budget scales the compute shader's resolution down to at least
+// --min-scale per axis when the gpu time goes over ms, the scale of every
+// frame is in the --timings output. --steps is the most steps per ray.
+// --pipeline-cache keeps the compiled pipelines between runs, "" turns it
+// off, the startup time is printed either way. --heatmap shows the steps,
+// deepest level or texel fetches of every ray with the compute shader and
+// prints their percentiles on exit, --heatmap-json also writes the
+// histograms.
+int main(int argc, char** argv)
 {
+    RenderOptions options;
+    std::string trace_path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = [&](int count) {
+            if (i + count >= argc)
+            {
+                std::cerr << "Missing value for " << argv[i] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            return argv + i + 1;
+        };
+
+        if (strcmp(argv[i], "--scene") == 0)
+        {
+            options.scene = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--size") == 0)
+        {
+            options.width = atoi(arg(2)[0]);
+            options.height = atoi(arg(2)[1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--pos") == 0)
+        {
+            char** values = arg(3);
+            options.camera.position = { atof(values[0]), atof(values[1]),
+                                        atof(values[2]) };
+            i += 3;
+        }
+        else if (strcmp(argv[i], "--yaw") == 0)
+        {
+            options.camera.yaw = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--pitch") == 0)
+        {
+            options.camera.pitch = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0)
+        {
+            options.frames = uint32_t(glm::max(1, atoi(arg(1)[0])));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--out") == 0)
+        {
+            options.png_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--record") == 0)
+        {
+            options.record_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--play") == 0)
+        {
+            options.play_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            trace_path = arg(1)[0];
+            profiler::setEnabled(true);
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--timings") == 0)
+        {
+            options.timings_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--timestep") == 0)
+        {
+            options.timestep = float(glm::max(1e-3, atof(arg(1)[0])));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--compute") == 0)
+        {
+            options.compute = true;
+        }
+        else if (strcmp(argv[i], "--checkerboard") == 0)
+        {
+            options.checkerboard = true;
+        }
+        else if (strcmp(argv[i], "--stackless") == 0)
+        {
+            options.traversal = Traversal::Stackless;
+        }
+        else if (strcmp(argv[i], "--dda") == 0)
+        {
+            options.traversal = Traversal::Dda;
+        }
+        else if (strcmp(argv[i], "--deep") == 0)
+        {
+            options.deep_precision = true;
+        }
+        else if (strcmp(argv[i], "--lod") == 0)
+        {
+            options.lod = true;
+            options.lod_bias = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--heatmap") == 0)
+        {
+            if (!parseHeatmapMetric(arg(1)[0], options.heatmap))
+            {
+                std::cerr << "Unknown heatmap metric " << argv[i + 1]
+                          << "\n";
+                return EXIT_FAILURE;
+            }
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--heatmap-json") == 0)
+        {
+            options.heatmap_json = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--beam") == 0)
+        {
+            options.beam = true;
+        }
+        else if (strcmp(argv[i], "--budget") == 0)
+        {
+            options.frame_budget_ms = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--min-scale") == 0)
+        {
+            options.min_scale = float(atof(arg(1)[0]));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--pipeline-cache") == 0)
+        {
+            options.pipeline_cache_path = arg(1)[0];
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--steps") == 0)
+        {
+            options.num_steps = uint32_t(glm::max(1, atoi(arg(1)[0])));
+            i += 1;
+        }
+        else if (strcmp(argv[i], "--tile") == 0)
+        {
+            options.tile_width = glm::max(1, atoi(arg(2)[0]));
+            options.tile_height = glm::max(1, atoi(arg(2)[1]));
+            i += 2;
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     try
     {
         Engine engine;
-        engine.init();
+        engine.init(options);
 
         while (engine.isRunning())
         {
             engine.update();
         }
         engine.cleanup();
+
+        if (!trace_path.empty())
+        {
+            profiler::writeChromeTrace(trace_path);
+        }
     }
     catch (const std::exception& e)
     {
         std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
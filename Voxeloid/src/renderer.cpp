@@ -1,13 +1,20 @@
 #include "renderer.hpp"
 
 #include "util/lodepng.h"
+#include "util/profiler.hpp"
 #include "util/runtimeerror.hpp"
+#include "voxelimport.hpp"
 
 #include <GLFW/glfw3.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
 #include <fstream>
+#include <future>
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <thread>
 #include <vulkan/vulkan.hpp>
 
 namespace
@@ -20,6 +27,9 @@ const std::vector<const char*> device_extensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// RGBA so the read back pixels can be written to PNG as they are
+const vk::Format OFFSCREEN_FORMAT = vk::Format::eR8G8B8A8Unorm;
+
 bool checkValidationLayerSupport()
 {
     auto available_layers = vk::enumerateInstanceLayerProperties();
@@ -118,59 +128,195 @@ vk::PresentModeKHR chooseSwapPresentMode(
     return vk::PresentModeKHR::eFifo;
 }
 
-static std::vector<char> readFile(const std::string& filename)
+// 4 byte specialization constants, the info points into the object
+class SpecializationConstants
 {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+  public:
+    void add(uint32_t id, uint32_t value) { push(id, &value); }
+    void add(uint32_t id, float value) { push(id, &value); }
 
-    if (!file.is_open())
+    const vk::SpecializationInfo* info()
     {
-        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+        specialization_info.mapEntryCount =
+            static_cast<uint32_t>(map_entries.size());
+        specialization_info.pMapEntries = map_entries.data();
+        specialization_info.dataSize = data.size() * sizeof(uint32_t);
+        specialization_info.pData = data.data();
+        return &specialization_info;
     }
-    size_t file_size = (size_t)file.tellg();
-    std::vector<char> buffer(file_size);
-    file.seekg(0);
-    file.read(buffer.data(), file_size);
-    file.close();
-    return buffer;
-}
+
+  private:
+    void push(uint32_t id, const void* value)
+    {
+        vk::SpecializationMapEntry entry;
+        entry.constantID = id;
+        entry.offset = static_cast<uint32_t>(data.size() * sizeof(uint32_t));
+        entry.size = sizeof(uint32_t);
+        map_entries.push_back(entry);
+        data.emplace_back();
+        memcpy(&data.back(), value, sizeof(uint32_t));
+    }
+
+    std::vector<vk::SpecializationMapEntry> map_entries;
+    std::vector<uint32_t> data;
+    vk::SpecializationInfo specialization_info;
+};
 
 } // namespace
 
-void Renderer::init()
+void Renderer::init(const RenderOptions& render_options)
 {
-    window_width = 1600;
-    window_height = 900;
+    PROFILE_SCOPE("Renderer::init");
+    Timer startup_timer;
+
+    options = render_options;
+    window_width = options.width;
+    window_height = options.height;
+    camera = options.camera;
+    prev_camera = camera;
+    // the checkerboard and the heatmap are variants of the compute shader
+    options.compute |= options.checkerboard;
+    options.compute |= options.heatmap != HeatmapMetric::None;
+    if (options.deep_precision && options.traversal == Traversal::Stack)
+    {
+        THROW_RUNTIME_ERROR("Deep precision needs the stackless or the DDA "
+                            "traversal");
+    }
+    if (options.lod && options.traversal == Traversal::Stack)
+    {
+        THROW_RUNTIME_ERROR("Level of detail needs the stackless or the DDA "
+                            "traversal");
+    }
+    if (options.frame_budget_ms > 0.f)
+    {
+        // their images and history are laid out for the full resolution
+        if (options.checkerboard || options.beam)
+        {
+            THROW_RUNTIME_ERROR("Dynamic resolution does not work with the "
+                                "checkerboard or the beam prepass");
+        }
+        options.compute = true;
+        options.min_scale = glm::clamp(options.min_scale, 0.1f, 1.f);
+        resolution_scaler = ResolutionScaler(options.frame_budget_ms,
+                                             options.min_scale, 1.f);
+    }
+
+    if (!options.play_path.empty())
+    {
+        camera_path = CameraPath::load(options.play_path);
+        options.frames = camera_path.frameCount(options.timestep);
+    }
+
+    if (options.scene.empty())
+    {
+        voxels = std::make_unique<VoxelOctree>();
+    }
+    else
+    {
+        VoxelGrid grid = importVoxels(options.scene);
+        voxels = std::make_unique<VoxelOctree>(grid.voxels, grid.depth);
+    }
 
-    initWindow();
+    if (!options.headless)
+    {
+        initWindow();
+    }
     createInstance();
     if (ENABLE_VALIDATION_LAYERS)
     {
         setupDebugMessenger();
     }
-    createSurface();
+    if (!options.headless)
+    {
+        createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    shader_compiler = std::make_unique<ShaderCompiler>();
+    if (options.headless)
+    {
+        createOffscreenTarget();
+    }
+    else
+    {
+        createSwapChain();
+    }
     createImageViews();
-    createRenderPass();
-    createDescriptorSetLayout();
-    createGraphicsPipeline();
-    createFramebuffers();
+    createStorageImages();
+    if (!options.compute)
+    {
+        createRenderPass();
+    }
+    descriptor_set_layout = createDescriptorSetLayout(options);
+    createPipelineCache();
+    createPipelines();
+    if (!options.compute)
+    {
+        createFramebuffers();
+    }
     createCommandPool();
+    if (options.checkerboard)
+    {
+        clearHistoryImages();
+    }
     createTextureImage();
     createTextureImageView();
     createTextureSampler();
     createUniformBuffers();
+    createHeatmapBuffers();
     createDescriptorPool();
     createDescriptorSets();
+    createQueryPool();
+    calibrateTimestamps();
     createCommandBuffers();
     createSyncObjects();
+
+    std::cout << "Started in " << startup_timer.RestartMS()
+              << " ms, pipelines " << pipelines_ms << " ms with a "
+              << (pipeline_cache_loaded ? "warm" : "cold")
+              << " pipeline cache";
+    if (pipeline_variants > 0)
+    {
+        std::cout << ", " << pipeline_variants
+                  << " other pipelines added to it";
+    }
+    std::cout << "\n";
+
+    headless_timer.Restart();
+    frame_timer.Restart();
 }
 
 void Renderer::cleanup()
 {
     device.waitIdle();
 
+    if (!options.record_path.empty())
+    {
+        camera_path.save(options.record_path);
+    }
+    if (!options.play_path.empty())
+    {
+        frame_times.printReport(std::cout);
+    }
+    if (!options.timings_path.empty())
+    {
+        timing_log.write(options.timings_path);
+    }
+    if (options.heatmap != HeatmapMetric::None)
+    {
+        // the last frame of every image was not read yet
+        for (uint32_t i = 0; i < heatmap_buffers.size(); i++)
+            readHeatmap(i);
+        heatmap_costs.printReport(std::cout);
+        if (!options.heatmap_json.empty())
+            heatmap_costs.writeJSON(options.heatmap_json);
+    }
+
+    if (timestamp_pool)
+    {
+        device.destroyQueryPool(timestamp_pool);
+    }
+
     device.destroySampler(texture_sampler);
     device.destroyImageView(texture_image_view);
 
@@ -179,9 +325,16 @@ void Renderer::cleanup()
 
     for (size_t i = 0; i < swap_chain_images.size(); i++)
     {
+        device.unmapMemory(uniform_buffers_memory[i]);
         device.destroyBuffer(uniform_buffers[i]);
         device.freeMemory(uniform_buffers_memory[i]);
     }
+    for (size_t i = 0; i < heatmap_buffers.size(); i++)
+    {
+        device.unmapMemory(heatmap_buffers_memory[i]);
+        device.destroyBuffer(heatmap_buffers[i]);
+        device.freeMemory(heatmap_buffers_memory[i]);
+    }
 
     device.destroyDescriptorPool(descriptor_pool);
 
@@ -200,6 +353,18 @@ void Renderer::cleanup()
     }
 
     device.destroyPipeline(graphics_pipeline);
+    device.destroyPipeline(compute_pipeline);
+    device.destroyPipeline(beam_pipeline);
+
+    savePipelineCache();
+    device.destroyPipelineCache(pipeline_cache);
+
+    for (auto& storage_image : storage_images)
+        destroyStorageImage(storage_image);
+    for (auto& beam_image : beam_images)
+        destroyStorageImage(beam_image);
+    for (auto& history_image : history_images)
+        destroyStorageImage(history_image);
 
     device.destroyPipelineLayout(pipeline_layout);
     device.destroyRenderPass(render_pass);
@@ -211,7 +376,15 @@ void Renderer::cleanup()
 
     device.destroyDescriptorSetLayout(descriptor_set_layout);
 
-    device.destroySwapchainKHR(swap_chain);
+    if (options.headless)
+    {
+        device.destroyImage(offscreen_image);
+        device.freeMemory(offscreen_image_memory);
+    }
+    else
+    {
+        device.destroySwapchainKHR(swap_chain);
+    }
     device.destroy();
 
     if (ENABLE_VALIDATION_LAYERS)
@@ -219,38 +392,66 @@ void Renderer::cleanup()
         vk_instance.destroyDebugUtilsMessengerEXT(debug_messenger, nullptr,
                                                   dldi);
     }
-    vkDestroySurfaceKHR(vk_instance, surface, nullptr);
+    if (!options.headless)
+    {
+        vkDestroySurfaceKHR(vk_instance, surface, nullptr);
+    }
     vk_instance.destroy();
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!options.headless)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 void Renderer::render()
 {
+    PROFILE_SCOPE("Renderer::render");
+
+    if (options.headless)
+    {
+        renderHeadless();
+        return;
+    }
+
+    FrameTiming& timing = timing_log.push(frames_rendered);
+    Timer step_timer;
+
     device.waitForFences(in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+    timing.fence_wait = step_timer.RestartMS();
 
     auto result = device.acquireNextImageKHR(
         swap_chain, UINT64_MAX, image_available_semaphores[current_frame], {});
     uint32_t image_index = result.value;
+    timing.acquire = step_timer.RestartMS();
 
     if (fences_used[image_index])
     {
         device.waitForFences(images_in_flight[image_index], VK_TRUE,
                              UINT64_MAX);
+        timing.fence_wait += step_timer.RestartMS();
+        readTimestamps(image_index);
+        readHeatmap(image_index);
+        updateRenderScale(image_index);
     }
     images_in_flight[image_index] = in_flight_fences[current_frame];
     fences_used[image_index] = true;
 
+    step_timer.Restart();
     updateUniformBuffer(image_index);
+    timing.uniform_update = step_timer.RestartMS();
+    timing.render_scale = renderScale(image_index);
 
     vk::SubmitInfo submit_info;
 
     vk::Semaphore wait_semaphores[] = {
         image_available_semaphores[current_frame]
     };
+    // the compute path first touches the swapchain image in the blit
     vk::PipelineStageFlags wait_stages[] = {
-        vk::PipelineStageFlagBits::eColorAttachmentOutput
+        options.compute ? vk::PipelineStageFlagBits::eTransfer
+                        : vk::PipelineStageFlagBits::eColorAttachmentOutput
     };
     submit_info.waitSemaphoreCount = 1;
     submit_info.pWaitSemaphores = wait_semaphores;
@@ -266,6 +467,8 @@ void Renderer::render()
 
     device.resetFences(in_flight_fences[current_frame]);
     graphics_queue.submit({ submit_info }, in_flight_fences[current_frame]);
+    image_frames[image_index] = frames_rendered;
+    timing.submit = step_timer.RestartMS();
 
     vk::PresentInfoKHR present_info;
     present_info.waitSemaphoreCount = 1;
@@ -278,17 +481,183 @@ void Renderer::render()
     present_info.pResults = nullptr; // Optional
 
     present_queue.presentKHR(present_info);
+    timing.present = step_timer.RestartMS();
+    timing.input_to_present =
+        latency_clock.ElapsedMS() - image_input_ms[image_index];
 
+    frames_rendered++;
     fps_counter++;
+    frame_times.add(frame_timer.Restart());
 
     current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void Renderer::renderHeadless()
+{
+    // No presentation to overlap with, every frame is waited for so the
+    // frame times include the whole GPU work
+    FrameTiming& timing = timing_log.push(frames_rendered);
+    Timer step_timer;
+
+    updateUniformBuffer(0);
+    timing.uniform_update = step_timer.RestartMS();
+    timing.render_scale = renderScale(0);
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffers[0];
+
+    device.resetFences(in_flight_fences[0]);
+    graphics_queue.submit({ submit_info }, in_flight_fences[0]);
+    image_frames[0] = frames_rendered;
+    timing.submit = step_timer.RestartMS();
+
+    device.waitForFences(in_flight_fences[0], VK_TRUE, UINT64_MAX);
+    timing.fence_wait = step_timer.RestartMS();
+    readTimestamps(0);
+    readHeatmap(0);
+    updateRenderScale(0);
+
+    frames_rendered++;
+    fps_counter++;
+    frame_times.add(frame_timer.Restart());
+
+    if (frames_rendered == options.frames)
+    {
+        double elapsed = headless_timer.Elapsed();
+        std::cout << "Rendered " << frames_rendered << " frames at "
+                  << swap_chain_extent.width << "x"
+                  << swap_chain_extent.height << ", "
+                  << 1000.0 * elapsed / frames_rendered << " ms/frame\n";
+        if (options.frame_budget_ms > 0.f)
+        {
+            double scale_sum = 0;
+            for (size_t i = 0; i < timing_log.size(); i++)
+                scale_sum += timing_log[i].render_scale;
+            std::cout << "Mean render scale " << scale_sum / timing_log.size()
+                      << " for a " << options.frame_budget_ms
+                      << " ms budget\n";
+        }
+
+        if (!options.png_path.empty())
+        {
+            saveOffscreenImage(options.png_path);
+        }
+    }
+}
+
+void Renderer::readTimestamps(uint32_t image_index)
+{
+    if (!timestamp_pool) return;
+
+    FrameTiming* timing = timing_log.find(image_frames[image_index]);
+    if (!timing) return;
+
+    uint64_t ticks[2] = {};
+    auto result = device.getQueryPoolResults(
+        timestamp_pool, 2 * image_index, 2, sizeof(ticks), ticks,
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess) return;
+
+    uint64_t elapsed = (ticks[1] - ticks[0]) & timestamp_mask;
+    timing->gpu = 1e-6 * double(elapsed) * timestamp_period;
+
+    uint64_t since_calibration = (ticks[1] - calibration_ticks) &
+                                 timestamp_mask;
+    double done_ms =
+        calibration_ms + 1e-6 * double(since_calibration) * timestamp_period;
+    timing->input_to_gpu_done = done_ms - image_input_ms[image_index];
+}
+
+void Renderer::readHeatmap(uint32_t image_index)
+{
+    if (heatmap_buffers.empty()) return;
+
+    auto* counts =
+        static_cast<uint32_t*>(heatmap_buffers_mapped[image_index]);
+    heatmap_costs.add(counts);
+    memset(counts, 0, 3 * CostHistogram::BINS * sizeof(uint32_t));
+}
+
+void Renderer::updateRenderScale(uint32_t image_index)
+{
+    if (options.frame_budget_ms <= 0.f) return;
+
+    FrameTiming* timing = timing_log.find(image_frames[image_index]);
+    if (!timing || timing->gpu < 0) return;
+
+    float scale = resolution_scaler.update(timing->gpu,
+                                           renderScale(image_index));
+    vk::Extent2D extent;
+    extent.width = std::max(
+        1U, uint32_t(std::lround(scale * swap_chain_extent.width)));
+    extent.height = std::max(
+        1U, uint32_t(std::lround(scale * swap_chain_extent.height)));
+    if (extent == render_extents[image_index]) return;
+
+    // the image's last frame is done, its fence was waited for
+    render_extents[image_index] = extent;
+    recordCommandBuffer(image_index);
+}
+
+float Renderer::renderScale(uint32_t image_index)
+{
+    return float(render_extents[image_index].width) /
+           float(swap_chain_extent.width);
+}
+
+void Renderer::saveOffscreenImage(const std::string& filename)
+{
+    uint32_t width = swap_chain_extent.width;
+    uint32_t height = swap_chain_extent.height;
+    vk::DeviceSize size = vk::DeviceSize(width) * height * 4U;
+
+    vk::Buffer buffer;
+    vk::DeviceMemory buffer_memory;
+    createBuffer(size, vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, buffer_memory);
+    memory::add(MemoryCategory::Staging, size);
+
+    // the frame leaves the image in eTransferSrcOptimal
+    vk::CommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    vk::BufferImageCopy region;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = vk::Extent3D{ width, height, 1 };
+    commandBuffer.copyImageToBuffer(offscreen_image,
+                                    vk::ImageLayout::eTransferSrcOptimal,
+                                    buffer, region);
+
+    endSingleTimeCommands(commandBuffer);
+
+    std::vector<uint8_t> pixels(size);
+    void* data = device.mapMemory(buffer_memory, 0, size);
+    memcpy(pixels.data(), data, static_cast<size_t>(size));
+    device.unmapMemory(buffer_memory);
+
+    device.destroyBuffer(buffer);
+    device.freeMemory(buffer_memory);
+    memory::remove(MemoryCategory::Staging, size);
+
+    unsigned error = lodepng::encode(filename, pixels, width, height);
+    if (error)
+    {
+        THROW_RUNTIME_ERROR("Failed to write '" + filename +
+                            "': " + lodepng_error_text(error));
+    }
+}
+
 void Renderer::updateWindow()
 {
-    glfwPollEvents();
+    if (options.headless)
+    {
+        return;
+    }
 
-    dt = timer.Restart();
+    // events are polled once per frame, in updateUniformBuffer
 
     if (fps_timer.Elapsed() > 1.0)
     {
@@ -297,13 +666,49 @@ void Renderer::updateWindow()
         double fps = fps_counter / elapsed;
 
         std::string title = "Vulkan " + std::to_string(fps);
+        // the newest frames are still in flight
+        size_t last_done = timing_log.size() > 4 ? timing_log.size() - 4 : 0;
+        if (timing_log.size() > 0 && timing_log[last_done].gpu >= 0)
+        {
+            title += "  gpu " + std::to_string(timing_log[last_done].gpu) +
+                     " ms  latency " +
+                     std::to_string(timing_log[last_done].input_to_gpu_done) +
+                     " ms";
+        }
+        if (options.frame_budget_ms > 0.f)
+        {
+            title += "  scale " + std::to_string(resolution_scaler.scale());
+        }
         glfwSetWindowTitle(window, title.c_str());
 
         fps_counter = 0;
     }
+
+    bool dump_key = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (dump_key && !dump_key_down)
+    {
+        std::string filename = options.timings_path.empty()
+                                   ? "frame_timings.csv"
+                                   : options.timings_path;
+        timing_log.write(filename);
+        std::cout << "Wrote " << timing_log.size() << " frame timings to "
+                  << filename << "\n";
+    }
+    dump_key_down = dump_key;
 }
 
-bool Renderer::isRunning() { return !glfwWindowShouldClose(window); }
+bool Renderer::isRunning()
+{
+    if (options.headless)
+    {
+        return frames_rendered < options.frames;
+    }
+    if (!options.play_path.empty() && frames_rendered >= options.frames)
+    {
+        return false;
+    }
+    return !glfwWindowShouldClose(window);
+}
 
 void Renderer::initWindow()
 {
@@ -334,11 +739,17 @@ void Renderer::createInstance()
         THROW_RUNTIME_ERROR("Validation layers requested, but not available");
     }
 
-    uint32_t glfw_extension_count = 0;
-    const char** glfw_extensions;
-    glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-    std::vector<const char*> extensions(glfw_extensions,
-                                        glfw_extensions + glfw_extension_count);
+    // headless rendering needs no surface extensions
+    std::vector<const char*> extensions;
+    if (!options.headless)
+    {
+        uint32_t glfw_extension_count = 0;
+        const char** glfw_extensions;
+        glfw_extensions =
+            glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        extensions.assign(glfw_extensions,
+                          glfw_extensions + glfw_extension_count);
+    }
 
     vk::ApplicationInfo app_info("EngineTest", VK_MAKE_VERSION(0, 1, 0),
                                  "Voxeloid", VK_MAKE_VERSION(0, 1, 0),
@@ -429,8 +840,11 @@ void Renderer::createLogicalDevice()
     device_create_info.queueCreateInfoCount = queue_create_infos.size();
     device_create_info.pEnabledFeatures = &device_features;
 
-    device_create_info.ppEnabledExtensionNames = device_extensions.data();
-    device_create_info.enabledExtensionCount = device_extensions.size();
+    if (!options.headless)
+    {
+        device_create_info.ppEnabledExtensionNames = device_extensions.data();
+        device_create_info.enabledExtensionCount = device_extensions.size();
+    }
 
     if (ENABLE_VALIDATION_LAYERS)
     {
@@ -469,6 +883,16 @@ void Renderer::createSwapChain()
     create_info.imageExtent = extent;
     create_info.imageArrayLayers = 1;
     create_info.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+    if (options.compute)
+    {
+        if (!(swap_chain_support.capabilities.supportedUsageFlags &
+              vk::ImageUsageFlagBits::eTransferDst))
+        {
+            THROW_RUNTIME_ERROR(
+                "Swapchain images can't be blitted to, use the fragment path");
+        }
+        create_info.imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
+    }
 
     QueueFamilyIndices indices = findQueueFamilies(physical_device);
     uint32_t queue_family_indices[] = { indices.graphics.value(),
@@ -498,6 +922,42 @@ void Renderer::createSwapChain()
     swap_chain_extent = extent;
 }
 
+void Renderer::createOffscreenTarget()
+{
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ window_width, window_height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.format = OFFSCREEN_FORMAT;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+    image_info.usage = vk::ImageUsageFlagBits::eColorAttachment |
+                       vk::ImageUsageFlagBits::eTransferSrc |
+                       vk::ImageUsageFlagBits::eTransferDst;
+    image_info.sharingMode = vk::SharingMode::eExclusive;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+
+    offscreen_image = device.createImage(image_info);
+
+    vk::MemoryRequirements mem_requirements =
+        device.getImageMemoryRequirements(offscreen_image);
+
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = mem_requirements.size;
+    alloc_info.memoryTypeIndex =
+        findMemoryType(mem_requirements.memoryTypeBits,
+                       vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    offscreen_image_memory = device.allocateMemory(alloc_info);
+    device.bindImageMemory(offscreen_image, offscreen_image_memory, 0);
+
+    // the rest of the setup treats it as a swapchain with one image
+    swap_chain_images = { offscreen_image };
+    swap_chain_format = OFFSCREEN_FORMAT;
+    swap_chain_extent = vk::Extent2D{ window_width, window_height };
+}
+
 void Renderer::createImageViews()
 {
     for (const auto& image : swap_chain_images)
@@ -532,7 +992,9 @@ void Renderer::createRenderPass()
     color_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     color_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
     color_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    color_attachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    color_attachment.finalLayout = options.headless
+                                       ? vk::ImageLayout::eTransferSrcOptimal
+                                       : vk::ImageLayout::ePresentSrcKHR;
 
     vk::AttachmentReference color_attachment_ref;
     color_attachment_ref.attachment = 0;
@@ -543,7 +1005,8 @@ void Renderer::createRenderPass()
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &color_attachment_ref;
 
-    vk::SubpassDependency dependency = {};
+    std::array<vk::SubpassDependency, 2> dependencies;
+    auto& dependency = dependencies[0];
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
     dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
@@ -552,51 +1015,102 @@ void Renderer::createRenderPass()
     dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead |
                                vk::AccessFlagBits::eColorAttachmentWrite;
 
+    // headless: the image is copied to a buffer after the pass
+    auto& readback_dependency = dependencies[1];
+    readback_dependency.srcSubpass = 0;
+    readback_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readback_dependency.srcStageMask =
+        vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    readback_dependency.srcAccessMask =
+        vk::AccessFlagBits::eColorAttachmentWrite;
+    readback_dependency.dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+    readback_dependency.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
     vk::RenderPassCreateInfo render_pass_info;
     render_pass_info.attachmentCount = 1;
     render_pass_info.pAttachments = &color_attachment;
     render_pass_info.subpassCount = 1;
     render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
+    render_pass_info.dependencyCount = options.headless ? 2 : 1;
+    render_pass_info.pDependencies = dependencies.data();
 
     render_pass = device.createRenderPass(render_pass_info);
 }
 
-void Renderer::createDescriptorSetLayout()
+vk::DescriptorSetLayout
+Renderer::createDescriptorSetLayout(const RenderOptions& layout_options)
 {
     vk::DescriptorSetLayoutBinding ubo_layout_binding;
     ubo_layout_binding.binding = 0;
     ubo_layout_binding.descriptorType = vk::DescriptorType::eUniformBuffer;
     ubo_layout_binding.descriptorCount = 1;
-    ubo_layout_binding.stageFlags =
-        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    ubo_layout_binding.stageFlags = vk::ShaderStageFlagBits::eVertex |
+                                    vk::ShaderStageFlagBits::eFragment |
+                                    vk::ShaderStageFlagBits::eCompute;
 
     vk::DescriptorSetLayoutBinding sampler_layout_binding;
     sampler_layout_binding.binding = 1;
     sampler_layout_binding.descriptorType =
         vk::DescriptorType::eCombinedImageSampler;
     sampler_layout_binding.descriptorCount = 1;
-    sampler_layout_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
-
-    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+    sampler_layout_binding.stageFlags =
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+
+    vk::DescriptorSetLayoutBinding storage_layout_binding;
+    storage_layout_binding.binding = 2;
+    storage_layout_binding.descriptorType = vk::DescriptorType::eStorageImage;
+    storage_layout_binding.descriptorCount = 1;
+    storage_layout_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    vk::DescriptorSetLayoutBinding beam_layout_binding;
+    beam_layout_binding.binding = 3;
+    beam_layout_binding.descriptorType = vk::DescriptorType::eStorageImage;
+    beam_layout_binding.descriptorCount = 1;
+    beam_layout_binding.stageFlags =
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+
+    // the storage images are only bound when they are used
+    std::vector<vk::DescriptorSetLayoutBinding> bindings = {
         ubo_layout_binding, sampler_layout_binding
     };
+    if (layout_options.compute) bindings.push_back(storage_layout_binding);
+    if (layout_options.beam) bindings.push_back(beam_layout_binding);
+    if (layout_options.heatmap != HeatmapMetric::None)
+    {
+        vk::DescriptorSetLayoutBinding heatmap_layout_binding;
+        heatmap_layout_binding.binding = 6;
+        heatmap_layout_binding.descriptorType =
+            vk::DescriptorType::eStorageBuffer;
+        heatmap_layout_binding.descriptorCount = 1;
+        heatmap_layout_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+        bindings.push_back(heatmap_layout_binding);
+    }
+    for (uint32_t binding = 4; layout_options.checkerboard && binding < 6;
+         binding++)
+    {
+        vk::DescriptorSetLayoutBinding history_layout_binding;
+        history_layout_binding.binding = binding;
+        history_layout_binding.descriptorType =
+            vk::DescriptorType::eStorageImage;
+        history_layout_binding.descriptorCount = 1;
+        history_layout_binding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+        bindings.push_back(history_layout_binding);
+    }
 
     vk::DescriptorSetLayoutCreateInfo layout_info = {};
     layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
-    ;
     layout_info.pBindings = bindings.data();
 
-    descriptor_set_layout = device.createDescriptorSetLayout(layout_info);
+    return device.createDescriptorSetLayout(layout_info);
 }
 
 void Renderer::createUniformBuffers()
 {
-    vk::DeviceSize buffer_size = 2 * sizeof(glm::vec4);
+    vk::DeviceSize buffer_size = sizeof(UniformBufferObject);
 
     uniform_buffers.resize(swap_chain_images.size());
     uniform_buffers_memory.resize(swap_chain_images.size());
+    uniform_buffers_mapped.resize(swap_chain_images.size());
 
     for (size_t i = 0; i < swap_chain_images.size(); i++)
     {
@@ -604,16 +1118,57 @@ void Renderer::createUniformBuffers()
                      vk::MemoryPropertyFlagBits::eHostVisible |
                          vk::MemoryPropertyFlagBits::eHostCoherent,
                      uniform_buffers[i], uniform_buffers_memory[i]);
+        uniform_buffers_mapped[i] =
+            device.mapMemory(uniform_buffers_memory[i], 0, buffer_size);
+    }
+}
+
+void Renderer::createHeatmapBuffers()
+{
+    if (options.heatmap == HeatmapMetric::None) return;
+
+    vk::DeviceSize buffer_size = 3 * CostHistogram::BINS * sizeof(uint32_t);
+
+    heatmap_buffers.resize(swap_chain_images.size());
+    heatmap_buffers_memory.resize(swap_chain_images.size());
+    heatmap_buffers_mapped.resize(swap_chain_images.size());
+
+    for (size_t i = 0; i < swap_chain_images.size(); i++)
+    {
+        // cleared by the command buffer before every dispatch
+        createBuffer(buffer_size,
+                     vk::BufferUsageFlagBits::eStorageBuffer |
+                         vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent,
+                     heatmap_buffers[i], heatmap_buffers_memory[i]);
+        heatmap_buffers_mapped[i] =
+            device.mapMemory(heatmap_buffers_memory[i], 0, buffer_size);
+        memset(heatmap_buffers_mapped[i], 0, size_t(buffer_size));
     }
 }
 
 void Renderer::createDescriptorPool()
 {
-	std::array<vk::DescriptorPoolSize, 2> poolSizes = {};
+	std::vector<vk::DescriptorPoolSize> poolSizes(3);
 	poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
 	poolSizes[0].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
 	poolSizes[1].type = vk::DescriptorType::eCombinedImageSampler;
 	poolSizes[1].descriptorCount = static_cast<uint32_t>(swap_chain_images.size());
+	poolSizes[2].type = vk::DescriptorType::eStorageImage;
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(
+        swap_chain_images.size() * (int(options.compute) + int(options.beam) +
+                                    2 * int(options.checkerboard)));
+
+    if (poolSizes[2].descriptorCount == 0) poolSizes.pop_back();
+    if (!heatmap_buffers.empty())
+    {
+        vk::DescriptorPoolSize heatmap_size;
+        heatmap_size.type = vk::DescriptorType::eStorageBuffer;
+        heatmap_size.descriptorCount =
+            static_cast<uint32_t>(heatmap_buffers.size());
+        poolSizes.push_back(heatmap_size);
+    }
 
     vk::DescriptorPoolCreateInfo pool_info;
     pool_info.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
@@ -640,14 +1195,14 @@ void Renderer::createDescriptorSets()
         vk::DescriptorBufferInfo buffer_info;
         buffer_info.buffer = uniform_buffers[i];
         buffer_info.offset = 0;
-        buffer_info.range = 2 * sizeof(glm::vec4);
+        buffer_info.range = sizeof(UniformBufferObject);
 
 		vk::DescriptorImageInfo imageInfo;
 		imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
 		imageInfo.imageView = texture_image_view;
 		imageInfo.sampler = texture_sampler;
 
-		std::array<vk::WriteDescriptorSet, 2> descriptorWrites;
+		std::vector<vk::WriteDescriptorSet> descriptorWrites(2);
 
 		descriptorWrites[0].dstSet = descriptor_sets[i];
 		descriptorWrites[0].dstBinding = 0;
@@ -663,27 +1218,362 @@ void Renderer::createDescriptorSets()
 		descriptorWrites[1].descriptorCount = 1;
 		descriptorWrites[1].pImageInfo = &imageInfo;
 
+        vk::DescriptorImageInfo storage_info;
+        storage_info.imageLayout = vk::ImageLayout::eGeneral;
+        if (options.compute)
+        {
+            storage_info.imageView = storage_images[i].view;
+
+            vk::WriteDescriptorSet write;
+            write.dstSet = descriptor_sets[i];
+            write.dstBinding = 2;
+            write.descriptorType = vk::DescriptorType::eStorageImage;
+            write.descriptorCount = 1;
+            write.pImageInfo = &storage_info;
+            descriptorWrites.push_back(write);
+        }
+
+        vk::DescriptorImageInfo beam_info;
+        beam_info.imageLayout = vk::ImageLayout::eGeneral;
+        if (options.beam)
+        {
+            beam_info.imageView = beam_images[i].view;
+
+            vk::WriteDescriptorSet write;
+            write.dstSet = descriptor_sets[i];
+            write.dstBinding = 3;
+            write.descriptorType = vk::DescriptorType::eStorageImage;
+            write.descriptorCount = 1;
+            write.pImageInfo = &beam_info;
+            descriptorWrites.push_back(write);
+        }
+
+        std::array<vk::DescriptorImageInfo, 2> history_infos;
+        for (size_t j = 0; j < history_images.size(); j++)
+        {
+            history_infos[j].imageLayout = vk::ImageLayout::eGeneral;
+            history_infos[j].imageView = history_images[j].view;
+
+            vk::WriteDescriptorSet write;
+            write.dstSet = descriptor_sets[i];
+            write.dstBinding = 4 + static_cast<uint32_t>(j);
+            write.descriptorType = vk::DescriptorType::eStorageImage;
+            write.descriptorCount = 1;
+            write.pImageInfo = &history_infos[j];
+            descriptorWrites.push_back(write);
+        }
+
+        vk::DescriptorBufferInfo heatmap_info;
+        if (!heatmap_buffers.empty())
+        {
+            heatmap_info.buffer = heatmap_buffers[i];
+            heatmap_info.offset = 0;
+            heatmap_info.range = VK_WHOLE_SIZE;
+
+            vk::WriteDescriptorSet write;
+            write.dstSet = descriptor_sets[i];
+            write.dstBinding = 6;
+            write.descriptorType = vk::DescriptorType::eStorageBuffer;
+            write.descriptorCount = 1;
+            write.pBufferInfo = &heatmap_info;
+            descriptorWrites.push_back(write);
+        }
+
         device.updateDescriptorSets(descriptorWrites, {});
     }
 }
 
-void Renderer::createGraphicsPipeline()
+void Renderer::createPipelineCache()
+{
+    // Drivers reject foreign data themselves, but not always gracefully.
+    // The file starts with the device and driver it was written by.
+    std::vector<char> initial_data;
+    std::ifstream file(options.pipeline_cache_path,
+                       std::ios::ate | std::ios::binary);
+    if (file.is_open())
+    {
+        uint64_t file_size = uint64_t(file.tellg());
+        file.seekg(0);
+
+        PipelineCacheHeader header;
+        PipelineCacheHeader expected = pipelineCacheHeader();
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (file &&
+            memcmp(&header, &expected,
+                   offsetof(PipelineCacheHeader, data_size)) == 0 &&
+            header.data_size == file_size - sizeof(header))
+        {
+            initial_data.resize(size_t(header.data_size));
+            file.read(initial_data.data(), initial_data.size());
+            if (!file) initial_data.clear();
+        }
+        if (initial_data.empty())
+        {
+            std::cout << "Warning: Ignoring the pipeline cache '"
+                      << options.pipeline_cache_path
+                      << "', it is from another device or driver or "
+                         "damaged\n";
+        }
+    }
+
+    vk::PipelineCacheCreateInfo cache_info;
+    cache_info.initialDataSize = initial_data.size();
+    cache_info.pInitialData = initial_data.data();
+    pipeline_cache = device.createPipelineCache(cache_info);
+    pipeline_cache_loaded = !initial_data.empty();
+}
+
+void Renderer::savePipelineCache()
+{
+    if (options.pipeline_cache_path.empty()) return;
+
+    std::vector<uint8_t> data = device.getPipelineCacheData(pipeline_cache);
+    PipelineCacheHeader header = pipelineCacheHeader();
+    header.data_size = data.size();
+
+    // replaced at once, a crash while writing keeps the old cache
+    std::string partial_path = options.pipeline_cache_path + ".tmp";
+    {
+        std::ofstream file(partial_path, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cout << "Warning: Failed to write the pipeline cache '"
+                      << partial_path << "'\n";
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+#ifdef _WIN32
+    // rename does not replace an existing file on Windows
+    std::remove(options.pipeline_cache_path.c_str());
+#endif
+    std::rename(partial_path.c_str(), options.pipeline_cache_path.c_str());
+}
+
+Renderer::PipelineCacheHeader Renderer::pipelineCacheHeader()
 {
-    auto vert_shader_code = readFile("shaders/shader_vert.spv");
-    auto frag_shader_code = readFile("shaders/shader_frag.spv");
+    auto properties = physical_device.getProperties();
+
+    PipelineCacheHeader header;
+    header.vendor_id = properties.vendorID;
+    header.device_id = properties.deviceID;
+    header.driver_version = properties.driverVersion;
+    memcpy(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+void Renderer::createPipelines()
+{
+    PROFILE_SCOPE("Renderer::createPipelines");
+    Timer pipelines_timer;
+
+    pipeline_layout = createPipelineLayout(descriptor_set_layout);
+
+    // Every pipeline compiles on its own thread, the pipeline cache
+    // synchronizes itself
+    auto create_main = [this](const RenderOptions& variant,
+                              vk::PipelineLayout layout) {
+        return options.compute ? createComputePipeline(variant, layout)
+                               : createGraphicsPipeline(variant, layout);
+    };
+    auto main_future = std::async(std::launch::async, create_main,
+                                  std::cref(options), pipeline_layout);
+    std::future<vk::Pipeline> beam_future;
+    if (options.beam)
+    {
+        beam_future = std::async(std::launch::async,
+                                 &Renderer::createBeamPipeline, this,
+                                 pipeline_layout);
+    }
+
+    // A cold cache also gets every other variant, so later runs with other
+    // options find theirs. Each is built against the layouts such a run
+    // creates, and only kept in the cache.
+    std::vector<RenderOptions> variants;
+    if (!pipeline_cache_loaded && !options.pipeline_cache_path.empty())
+    {
+        variants = pipelineVariants();
+    }
+    std::atomic<size_t> next_variant{ 0 };
+    std::atomic<size_t> created{ 0 };
+    auto variant_worker = [&]() {
+        for (size_t i = next_variant++; i < variants.size();
+             i = next_variant++)
+        {
+            const RenderOptions& variant = variants[i];
+            vk::DescriptorSetLayout set_layout;
+            vk::PipelineLayout layout;
+            try
+            {
+                set_layout = createDescriptorSetLayout(variant);
+                layout = createPipelineLayout(set_layout);
+                device.destroyPipeline(create_main(variant, layout));
+                created++;
+                // the beam pipeline only depends on the layout, which the
+                // stack variant shares with the others of its flags
+                if (variant.beam && variant.traversal == Traversal::Stack)
+                {
+                    device.destroyPipeline(createBeamPipeline(layout));
+                    created++;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                std::cout << "Warning: pipeline variant" +
+                                 variantDefines(variant) +
+                                 " not cached: " + e.what() + "\n";
+            }
+            // null if their creation threw
+            device.destroyPipelineLayout(layout);
+            device.destroyDescriptorSetLayout(set_layout);
+        }
+    };
+    std::vector<std::future<void>> variant_futures;
+    unsigned num_threads = glm::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < num_threads && i < variants.size(); i++)
+    {
+        variant_futures.push_back(
+            std::async(std::launch::async, variant_worker));
+    }
+    for (auto& future : variant_futures)
+        future.get();
+
+    if (options.compute)
+        compute_pipeline = main_future.get();
+    else
+        graphics_pipeline = main_future.get();
+    if (options.beam)
+    {
+        beam_pipeline = beam_future.get();
+    }
+    pipeline_variants = created;
+
+    pipelines_ms = pipelines_timer.ElapsedMS();
+}
+
+vk::PipelineLayout
+Renderer::createPipelineLayout(vk::DescriptorSetLayout set_layout)
+{
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &set_layout;
+
+    return device.createPipelineLayout(pipeline_layout_info);
+}
+
+std::string Renderer::variantDefines(const RenderOptions& variant)
+{
+    std::string defines;
+    if (variant.beam) defines += " BEAM";
+    if (variant.checkerboard) defines += " CHECKERBOARD";
+    if (variant.traversal == Traversal::Stackless) defines += " STACKLESS";
+    if (variant.traversal == Traversal::Dda) defines += " DDA";
+    if (variant.deep_precision) defines += " DEEP";
+    if (variant.heatmap != HeatmapMetric::None) defines += " HEATMAP";
+    return defines;
+}
+
+std::vector<RenderOptions> Renderer::pipelineVariants()
+{
+    std::vector<RenderOptions> variants;
+    for (bool beam : { false, true })
+    {
+        for (bool checkerboard : { false, true })
+        {
+            for (Traversal traversal :
+                 { Traversal::Stack, Traversal::Stackless, Traversal::Dda })
+            {
+                for (bool deep : { false, true })
+                {
+                    for (bool heatmap : { false, true })
+                    {
+                        // shader.frag has no checkerboard or heatmap, and
+                        // the stack traversal no deep precision
+                        if (!options.compute && (checkerboard || heatmap))
+                            continue;
+                        if (deep && traversal == Traversal::Stack) continue;
+
+                        RenderOptions variant = options;
+                        variant.beam = beam;
+                        variant.checkerboard = checkerboard;
+                        variant.traversal = traversal;
+                        variant.deep_precision = deep;
+                        variant.heatmap = heatmap ? HeatmapMetric::Steps
+                                                  : HeatmapMetric::None;
+                        if (beam != options.beam ||
+                            checkerboard != options.checkerboard ||
+                            traversal != options.traversal ||
+                            deep != options.deep_precision ||
+                            heatmap != (options.heatmap != HeatmapMetric::None))
+                        {
+                            variants.push_back(variant);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return variants;
+}
+
+vk::Pipeline Renderer::createGraphicsPipeline(const RenderOptions& variant,
+                                              vk::PipelineLayout layout)
+{
+    auto vert_shader_code = shader_compiler->compile(
+        "shaders/shader.vert", {}, "shaders/shader_vert.spv");
+    std::vector<std::string> defines;
+    std::string offline_spv = "shaders/shader_frag";
+    if (variant.beam)
+    {
+        defines.push_back("BEAM");
+        offline_spv += "_beam";
+    }
+    if (variant.traversal == Traversal::Stackless)
+    {
+        defines.push_back("STACKLESS");
+        offline_spv += "_stackless";
+    }
+    else if (variant.traversal == Traversal::Dda)
+    {
+        defines.push_back("DDA");
+        offline_spv += "_dda";
+    }
+    if (variant.deep_precision)
+    {
+        defines.push_back("DEEP");
+        offline_spv += "_deep";
+    }
+    auto frag_shader_code = shader_compiler->compile(
+        "shaders/shader.frag", defines, offline_spv + ".spv");
 
     auto vert_shader_module = createShaderModule(vert_shader_code);
     auto frag_shader_module = createShaderModule(frag_shader_code);
 
+    SpecializationConstants vert_constants;
+    vert_constants.add(0, float(swap_chain_extent.width) /
+                              float(swap_chain_extent.height));
+
+    SpecializationConstants frag_constants;
+    frag_constants.add(0, uint32_t(voxels->getDepth()));
+    frag_constants.add(1, options.num_steps);
+    // a pixel spans 2 / height at unit distance, like in CpuRenderer
+    frag_constants.add(2, options.lod
+                              ? glm::exp2(options.lod_bias) * 2.f /
+                                    float(swap_chain_extent.height)
+                              : 0.f);
+
     vk::PipelineShaderStageCreateInfo vert_stage_info;
     vert_stage_info.stage = vk::ShaderStageFlagBits::eVertex;
-    vert_stage_info.module = vert_shader_module;
+    vert_stage_info.module = *vert_shader_module;
     vert_stage_info.pName = "main";
+    vert_stage_info.pSpecializationInfo = vert_constants.info();
 
     vk::PipelineShaderStageCreateInfo frag_stage_info;
     frag_stage_info.stage = vk::ShaderStageFlagBits::eFragment;
-    frag_stage_info.module = frag_shader_module;
+    frag_stage_info.module = *frag_shader_module;
     frag_stage_info.pName = "main";
+    frag_stage_info.pSpecializationInfo = frag_constants.info();
 
     vk::PipelineShaderStageCreateInfo shader_stages[] = { vert_stage_info,
                                                           frag_stage_info };
@@ -758,14 +1648,6 @@ void Renderer::createGraphicsPipeline()
     color_blending.blendConstants[2] = 0.0f;
     color_blending.blendConstants[3] = 0.0f;
 
-    vk::PipelineLayoutCreateInfo pipeline_layout_info;
-    pipeline_layout_info.setLayoutCount = 1;
-    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
-    pipeline_layout_info.pushConstantRangeCount = 0;
-    pipeline_layout_info.pPushConstantRanges = nullptr;
-
-    pipeline_layout = device.createPipelineLayout(pipeline_layout_info);
-
     vk::GraphicsPipelineCreateInfo pipeline_info = {};
     pipeline_info.stageCount = 2;
     pipeline_info.pStages = shader_stages;
@@ -777,16 +1659,13 @@ void Renderer::createGraphicsPipeline()
     pipeline_info.pDepthStencilState = nullptr; // Optional
     pipeline_info.pColorBlendState = &color_blending;
     pipeline_info.pDynamicState = nullptr; // Optional
-    pipeline_info.layout = pipeline_layout;
+    pipeline_info.layout = layout;
     pipeline_info.renderPass = render_pass;
     pipeline_info.subpass = 0;
     //pipelineInfo.basePipelineHandle = ; // Optional
     pipeline_info.basePipelineIndex = -1; // Optional
 
-    graphics_pipeline = device.createGraphicsPipeline({}, pipeline_info);
-
-    device.destroyShaderModule(vert_shader_module);
-    device.destroyShaderModule(frag_shader_module);
+    return device.createGraphicsPipeline(pipeline_cache, pipeline_info);
 }
 
 void Renderer::createFramebuffers()
@@ -808,6 +1687,241 @@ void Renderer::createFramebuffers()
     }
 }
 
+Renderer::StorageImage Renderer::createStorageImage(uint32_t width,
+                                                    uint32_t height,
+                                                    vk::Format format,
+                                                    vk::ImageUsageFlags usage)
+{
+    StorageImage result;
+
+    vk::ImageCreateInfo image_info;
+    image_info.imageType = vk::ImageType::e2D;
+    image_info.extent = vk::Extent3D{ width, height, 1 };
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.format = format;
+    image_info.tiling = vk::ImageTiling::eOptimal;
+    image_info.initialLayout = vk::ImageLayout::eUndefined;
+    image_info.usage = vk::ImageUsageFlagBits::eStorage | usage;
+    image_info.sharingMode = vk::SharingMode::eExclusive;
+    image_info.samples = vk::SampleCountFlagBits::e1;
+
+    result.image = device.createImage(image_info);
+
+    vk::MemoryRequirements mem_requirements =
+        device.getImageMemoryRequirements(result.image);
+
+    vk::MemoryAllocateInfo alloc_info;
+    alloc_info.allocationSize = mem_requirements.size;
+    alloc_info.memoryTypeIndex =
+        findMemoryType(mem_requirements.memoryTypeBits,
+                       vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    result.memory = device.allocateMemory(alloc_info);
+    device.bindImageMemory(result.image, result.memory, 0);
+
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = result.image;
+    view_info.viewType = vk::ImageViewType::e2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+
+    result.view = device.createImageView(view_info);
+    return result;
+}
+
+void Renderer::destroyStorageImage(StorageImage& storage_image)
+{
+    device.destroyImageView(storage_image.view);
+    device.destroyImage(storage_image.image);
+    device.freeMemory(storage_image.memory);
+}
+
+void Renderer::createStorageImages()
+{
+    uint32_t blocks_x = (swap_chain_extent.width + BEAM_BLOCK - 1) / BEAM_BLOCK;
+    uint32_t blocks_y =
+        (swap_chain_extent.height + BEAM_BLOCK - 1) / BEAM_BLOCK;
+
+    // Dynamic resolution traces into the top left of the full size images
+    // and the blit scales it up, filtered if the format allows
+    vk::FormatProperties format_properties =
+        physical_device.getFormatProperties(vk::Format::eR8G8B8A8Unorm);
+    if (format_properties.optimalTilingFeatures &
+        vk::FormatFeatureFlagBits::eSampledImageFilterLinear)
+    {
+        blit_filter = vk::Filter::eLinear;
+    }
+
+    for (size_t i = 0; i < swap_chain_images.size(); i++)
+    {
+        if (options.compute)
+        {
+            storage_images.push_back(createStorageImage(
+                swap_chain_extent.width, swap_chain_extent.height,
+                vk::Format::eR8G8B8A8Unorm,
+                vk::ImageUsageFlagBits::eTransferSrc));
+        }
+        if (options.beam)
+        {
+            beam_images.push_back(createStorageImage(
+                blocks_x, blocks_y, vk::Format::eR32Sfloat, {}));
+        }
+    }
+
+    // shared by all frames, they run in order on the one queue
+    for (int i = 0; options.checkerboard && i < 2; i++)
+    {
+        history_images.push_back(createStorageImage(
+            swap_chain_extent.width, swap_chain_extent.height,
+            vk::Format::eR16G16B16A16Sfloat,
+            vk::ImageUsageFlagBits::eTransferDst));
+    }
+}
+
+void Renderer::clearHistoryImages()
+{
+    vk::CommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    vk::ImageSubresourceRange color_range;
+    color_range.aspectMask = vk::ImageAspectFlagBits::eColor;
+    color_range.levelCount = 1;
+    color_range.layerCount = 1;
+
+    // hit distance -1, nothing is reprojected from them
+    vk::ClearColorValue miss(std::array<float, 4>{ 0.f, 0.f, 0.f, -1.f });
+
+    for (auto& history_image : history_images)
+    {
+        vk::ImageMemoryBarrier barrier;
+        barrier.oldLayout = vk::ImageLayout::eUndefined;
+        barrier.newLayout = vk::ImageLayout::eGeneral;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = history_image.image;
+        barrier.subresourceRange = color_range;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                      vk::PipelineStageFlagBits::eTransfer, {},
+                                      {}, {}, barrier);
+
+        commandBuffer.clearColorImage(history_image.image,
+                                      vk::ImageLayout::eGeneral, miss,
+                                      color_range);
+    }
+
+    endSingleTimeCommands(commandBuffer);
+}
+
+vk::Pipeline Renderer::createComputePipeline(const RenderOptions& variant,
+                                             vk::PipelineLayout layout)
+{
+    auto limits = physical_device.getProperties().limits;
+    if (options.tile_width * options.tile_height >
+            limits.maxComputeWorkGroupInvocations ||
+        options.tile_width > limits.maxComputeWorkGroupSize[0] ||
+        options.tile_height > limits.maxComputeWorkGroupSize[1])
+    {
+        THROW_RUNTIME_ERROR("Tile size " + std::to_string(options.tile_width) +
+                            "x" + std::to_string(options.tile_height) +
+                            " is too large for the device");
+    }
+    // the shared array of the traced samples in shader.comp
+    if (variant.checkerboard && options.tile_width * options.tile_height > 256)
+    {
+        THROW_RUNTIME_ERROR("Checkerboard tiles are at most 256 invocations");
+    }
+
+    std::vector<std::string> defines;
+    std::string offline_spv = "shaders/shader_comp";
+    if (variant.beam)
+    {
+        defines.push_back("BEAM");
+        offline_spv += "_beam";
+    }
+    if (variant.checkerboard)
+    {
+        defines.push_back("CHECKERBOARD");
+        offline_spv += "_checker";
+    }
+    if (variant.traversal == Traversal::Stackless)
+    {
+        defines.push_back("STACKLESS");
+        offline_spv += "_stackless";
+    }
+    else if (variant.traversal == Traversal::Dda)
+    {
+        defines.push_back("DDA");
+        offline_spv += "_dda";
+    }
+    if (variant.deep_precision)
+    {
+        defines.push_back("DEEP");
+        offline_spv += "_deep";
+    }
+    if (variant.heatmap != HeatmapMetric::None)
+    {
+        defines.push_back("HEATMAP");
+        offline_spv += "_heatmap";
+    }
+    auto comp_shader_code = shader_compiler->compile(
+        "shaders/shader.comp", defines, offline_spv + ".spv");
+    auto comp_shader_module = createShaderModule(comp_shader_code);
+
+    // constant ids 0 and 1 are local_size_x_id and local_size_y_id
+    SpecializationConstants constants;
+    constants.add(0, options.tile_width);
+    constants.add(1, options.tile_height);
+    constants.add(2, uint32_t(voxels->getDepth()));
+    constants.add(3, options.num_steps);
+    constants.add(4, uint32_t(variant.heatmap));
+    constants.add(5, options.lod ? glm::exp2(options.lod_bias) : 0.f);
+
+    vk::PipelineShaderStageCreateInfo comp_stage_info;
+    comp_stage_info.stage = vk::ShaderStageFlagBits::eCompute;
+    comp_stage_info.module = *comp_shader_module;
+    comp_stage_info.pName = "main";
+    comp_stage_info.pSpecializationInfo = constants.info();
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = comp_stage_info;
+    pipeline_info.layout = layout;
+
+    return device.createComputePipeline(pipeline_cache, pipeline_info);
+}
+
+vk::Pipeline Renderer::createBeamPipeline(vk::PipelineLayout layout)
+{
+    auto beam_shader_code = shader_compiler->compile(
+        "shaders/beam.comp", {}, "shaders/beam_comp.spv");
+    auto beam_shader_module = createShaderModule(beam_shader_code);
+
+    // the cones have to hold the rays of both paths, which have the same
+    // size and aspect
+    SpecializationConstants constants;
+    constants.add(0, 8U);
+    constants.add(1, 8U);
+    constants.add(2, swap_chain_extent.width);
+    constants.add(3, swap_chain_extent.height);
+    constants.add(4, float(swap_chain_extent.width) /
+                         float(swap_chain_extent.height));
+    constants.add(5, uint32_t(voxels->getDepth()));
+
+    vk::PipelineShaderStageCreateInfo beam_stage_info;
+    beam_stage_info.stage = vk::ShaderStageFlagBits::eCompute;
+    beam_stage_info.module = *beam_shader_module;
+    beam_stage_info.pName = "main";
+    beam_stage_info.pSpecializationInfo = constants.info();
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = beam_stage_info;
+    pipeline_info.layout = layout;
+
+    return device.createComputePipeline(pipeline_cache, pipeline_info);
+}
+
 void Renderer::createCommandPool()
 {
     QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physical_device);
@@ -815,22 +1929,26 @@ void Renderer::createCommandPool()
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = queueFamilyIndices.graphics.value();
-    pool_info.flags = 0; // Optional
+    // dynamic resolution re-records the command buffers
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     command_pool = device.createCommandPool(pool_info);
 }
 
 void Renderer::createTextureImage()
 {
-    size_t side = voxels.getIndirectSize();
+    PROFILE_SCOPE("texture upload");
+
+    size_t side = voxels->getIndirectSize();
     vk::DeviceSize image_size = side * side * side * 4U;
     createBuffer(image_size, vk::BufferUsageFlagBits::eTransferSrc,
                  vk::MemoryPropertyFlagBits::eHostVisible |
                      vk::MemoryPropertyFlagBits::eHostCoherent,
                  staging_buffer, staging_buffer_memory);
+    memory::add(MemoryCategory::Staging, image_size);
 
     void* data = device.mapMemory(staging_buffer_memory, 0, image_size);
-    memcpy(data, voxels.getIndirectTexture().data(),
+    memcpy(data, voxels->getIndirectTexture().data(),
            static_cast<size_t>(image_size));
     device.unmapMemory(staging_buffer_memory);
 
@@ -854,6 +1972,7 @@ void Renderer::createTextureImage()
 
     device.destroyBuffer(staging_buffer);
     device.freeMemory(staging_buffer_memory);
+    memory::remove(MemoryCategory::Staging, image_size);
 }
 
 void Renderer::createTextureImageView()
@@ -898,27 +2017,53 @@ void Renderer::createCommandBuffers()
     vk::CommandBufferAllocateInfo alloc_info;
     alloc_info.commandPool = command_pool;
     alloc_info.level = vk::CommandBufferLevel::ePrimary;
-    alloc_info.commandBufferCount = (uint32_t)swap_chain_framebuffers.size();
+    alloc_info.commandBufferCount = (uint32_t)swap_chain_images.size();
 
     command_buffers = device.allocateCommandBuffers(alloc_info);
+    render_extents.resize(command_buffers.size(), swap_chain_extent);
 
     for (size_t i = 0; i < command_buffers.size(); i++)
     {
-        auto& command_buffer = command_buffers[i];
-        vk::CommandBufferBeginInfo begin_info;
-        command_buffer.begin(begin_info);
+        recordCommandBuffer(i);
+    }
+}
 
-        vk::RenderPassBeginInfo render_pass_info;
-        render_pass_info.renderPass = render_pass;
-        render_pass_info.framebuffer = swap_chain_framebuffers[i];
-        render_pass_info.renderArea.offset = { 0, 0 };
-        render_pass_info.renderArea.extent = swap_chain_extent;
+void Renderer::recordCommandBuffer(size_t image_index)
+{
+    auto& command_buffer = command_buffers[image_index];
+    vk::CommandBufferBeginInfo begin_info;
+    command_buffer.begin(begin_info);
+
+    vk::RenderPassBeginInfo render_pass_info;
+    render_pass_info.renderPass = render_pass;
+    render_pass_info.framebuffer = swap_chain_framebuffers[image_index];
+    render_pass_info.renderArea.offset = { 0, 0 };
+    render_pass_info.renderArea.extent = swap_chain_extent;
+
+    vk::ClearValue clear_color =
+        vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
+    render_pass_info.clearValueCount = 1;
+    render_pass_info.pClearValues = &clear_color;
+
+    uint32_t first_query = 2 * static_cast<uint32_t>(image_index);
+    if (timestamp_pool)
+    {
+        command_buffer.resetQueryPool(timestamp_pool, first_query, 2);
+        command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                                      timestamp_pool, first_query);
+    }
 
-        vk::ClearValue clear_color =
-            vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
-        render_pass_info.clearValueCount = 1;
-        render_pass_info.pClearValues = &clear_color;
+    if (options.beam)
+    {
+        recordBeamPrepass(command_buffer, image_index);
+    }
 
+    if (options.compute)
+    {
+        recordCompute(command_buffer, image_index);
+    }
+    else
+    {
         command_buffer.beginRenderPass(render_pass_info,
                                        vk::SubpassContents::eInline);
         command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
@@ -926,13 +2071,205 @@ void Renderer::createCommandBuffers()
 
         command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
                                           pipeline_layout, 0,
-                                          descriptor_sets[i], {});
+                                          descriptor_sets[image_index], {});
 
         command_buffer.draw(3, 1, 0, 0);
         command_buffer.endRenderPass();
+    }
+
+    if (timestamp_pool)
+    {
+        command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                      timestamp_pool, first_query + 1);
+    }
+
+    command_buffer.end();
+}
+
+void Renderer::recordBeamPrepass(vk::CommandBuffer command_buffer,
+                                 size_t image_index)
+{
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eGeneral;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = beam_images[image_index].image;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+
+    vk::PipelineStageFlags trace_stages =
+        vk::PipelineStageFlagBits::eFragmentShader |
+        vk::PipelineStageFlagBits::eComputeShader;
+
+    // the last frame's rays are done reading the distances
+    command_buffer.pipelineBarrier(trace_stages,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   {}, {}, {}, barrier);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                beam_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                      pipeline_layout, 0,
+                                      descriptor_sets[image_index], {});
+
+    uint32_t blocks_x = (swap_chain_extent.width + BEAM_BLOCK - 1) / BEAM_BLOCK;
+    uint32_t blocks_y =
+        (swap_chain_extent.height + BEAM_BLOCK - 1) / BEAM_BLOCK;
+    command_buffer.dispatch((blocks_x + 7) / 8, (blocks_y + 7) / 8, 1);
+
+    barrier.oldLayout = vk::ImageLayout::eGeneral;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   trace_stages, {}, {}, {}, barrier);
+}
+
+void Renderer::recordCompute(vk::CommandBuffer command_buffer,
+                             size_t image_index)
+{
+    vk::Image storage_image = storage_images[image_index].image;
+    vk::Image target_image = swap_chain_images[image_index];
+    vk::Extent2D render_extent = render_extents[image_index];
+
+    vk::ImageSubresourceRange color_range;
+    color_range.aspectMask = vk::ImageAspectFlagBits::eColor;
+    color_range.levelCount = 1;
+    color_range.layerCount = 1;
+
+    // the previous frame's blit is done reading, the contents are dropped
+    vk::ImageMemoryBarrier to_general;
+    to_general.oldLayout = vk::ImageLayout::eUndefined;
+    to_general.newLayout = vk::ImageLayout::eGeneral;
+    to_general.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_general.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_general.image = storage_image;
+    to_general.subresourceRange = color_range;
+    to_general.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   {}, {}, {}, to_general);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                compute_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                      pipeline_layout, 0,
+                                      descriptor_sets[image_index], {});
+
+    if (!heatmap_buffers.empty())
+    {
+        command_buffer.fillBuffer(heatmap_buffers[image_index], 0,
+                                  VK_WHOLE_SIZE, 0);
+        vk::MemoryBarrier cleared;
+        cleared.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        cleared.dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eComputeShader, {}, cleared, {}, {});
+    }
+
+    if (options.checkerboard)
+    {
+        // the last frame wrote the history this one reads
+        vk::MemoryBarrier history_barrier;
+        history_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        history_barrier.dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eComputeShader, {}, history_barrier, {},
+            {});
+    }
+
+    // checkerboard invocations handle two horizontal pixels
+    uint32_t tile_width = options.tile_width * (options.checkerboard ? 2 : 1);
+    uint32_t groups_x = (render_extent.width + tile_width - 1) / tile_width;
+    uint32_t groups_y = (render_extent.height + options.tile_height - 1) /
+                        options.tile_height;
+    command_buffer.dispatch(groups_x, groups_y, 1);
+
+    if (!heatmap_buffers.empty())
+    {
+        // read by readHeatmap after the fence
+        vk::MemoryBarrier counted;
+        counted.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        counted.dstAccessMask = vk::AccessFlagBits::eHostRead;
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eHost, {}, counted, {}, {});
+    }
+
+    std::array<vk::ImageMemoryBarrier, 2> to_transfer;
+    to_transfer[0].oldLayout = vk::ImageLayout::eGeneral;
+    to_transfer[0].newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    to_transfer[0].srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    to_transfer[0].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+    to_transfer[0].image = storage_image;
 
-        command_buffer.end();
+    // the acquire semaphore is waited for at the transfer stage
+    to_transfer[1].oldLayout = vk::ImageLayout::eUndefined;
+    to_transfer[1].newLayout = vk::ImageLayout::eTransferDstOptimal;
+    to_transfer[1].dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    to_transfer[1].image = target_image;
+
+    for (auto& barrier : to_transfer)
+    {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange = color_range;
+    }
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader |
+                                       vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eTransfer, {},
+                                   {}, {}, to_transfer);
+
+    // converts to the swapchain format, and scales the traced corner up
+    // with dynamic resolution
+    vk::ImageBlit blit;
+    blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[1] = vk::Offset3D{ int32_t(render_extent.width),
+                                       int32_t(render_extent.height), 1 };
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstOffsets[1] =
+        vk::Offset3D{ int32_t(swap_chain_extent.width),
+                      int32_t(swap_chain_extent.height), 1 };
+
+    bool scaled = render_extent != swap_chain_extent;
+    command_buffer.blitImage(storage_image,
+                             vk::ImageLayout::eTransferSrcOptimal,
+                             target_image, vk::ImageLayout::eTransferDstOptimal,
+                             blit, scaled ? blit_filter : vk::Filter::eNearest);
+
+    // headless: the image is copied to a buffer afterwards, like after the
+    // render pass
+    vk::ImageMemoryBarrier to_present;
+    to_present.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    to_present.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    if (options.headless)
+    {
+        to_present.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+        to_present.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+    }
+    else
+    {
+        to_present.newLayout = vk::ImageLayout::ePresentSrcKHR;
     }
+    to_present.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_present.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_present.image = target_image;
+    to_present.subresourceRange = color_range;
+
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        options.headless ? vk::PipelineStageFlagBits::eTransfer
+                         : vk::PipelineStageFlagBits::eBottomOfPipe,
+        {}, {}, {}, to_present);
 }
 
 void Renderer::createSyncObjects()
@@ -956,7 +2293,100 @@ void Renderer::createSyncObjects()
     }
 }
 
+void Renderer::createQueryPool()
+{
+    image_frames.resize(swap_chain_images.size(), 0);
+
+    QueueFamilyIndices indices = findQueueFamilies(physical_device);
+    auto families = physical_device.getQueueFamilyProperties();
+    uint32_t valid_bits = families[indices.graphics.value()].timestampValidBits;
+    if (valid_bits == 0)
+    {
+        std::cout << "Warning: No timestamp support, gpu times are missing\n";
+        return;
+    }
+    timestamp_mask = valid_bits >= 64 ? ~uint64_t(0)
+                                      : (uint64_t(1) << valid_bits) - 1;
+    timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+
+    vk::QueryPoolCreateInfo pool_info;
+    pool_info.queryType = vk::QueryType::eTimestamp;
+    pool_info.queryCount = 2 * static_cast<uint32_t>(swap_chain_images.size());
+
+    timestamp_pool = device.createQueryPool(pool_info);
+}
+
+void Renderer::calibrateTimestamps()
+{
+    image_input_ms.resize(swap_chain_images.size(), 0.0);
+    if (!timestamp_pool) return;
+
+    // The query is free until the frame command buffers run. The GPU time
+    // is taken as the middle of the CPU times around the submit, clock
+    // drift is ignored.
+    double before_ms = latency_clock.ElapsedMS();
+    vk::CommandBuffer commandBuffer = beginSingleTimeCommands();
+    commandBuffer.resetQueryPool(timestamp_pool, 0, 1);
+    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                 timestamp_pool, 0);
+    endSingleTimeCommands(commandBuffer);
+    double after_ms = latency_clock.ElapsedMS();
+
+    auto result = device.getQueryPoolResults(
+        timestamp_pool, 0, 1, sizeof(calibration_ticks), &calibration_ticks,
+        sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess)
+    {
+        THROW_RUNTIME_ERROR("Failed to read the calibration timestamp");
+    }
+    calibration_ms = 0.5 * (before_ms + after_ms);
+}
+
 void Renderer::updateUniformBuffer(uint32_t current_image)
+{
+    PROFILE_SCOPE("updateUniformBuffer");
+
+    // Input is sampled here, after all fence waits and right before the
+    // submit, so the frame shows the newest input
+    if (window)
+    {
+        glfwPollEvents();
+    }
+    dt = timer.Restart();
+    image_input_ms[current_image] = latency_clock.ElapsedMS();
+
+    if (!options.play_path.empty())
+    {
+        camera = camera_path.sample(frames_rendered * options.timestep);
+    }
+    else if (window)
+    {
+        updateCameraInput();
+    }
+
+    if (!options.record_path.empty())
+    {
+        camera_path.addKeyframe(record_time, camera);
+        record_time += dt;
+    }
+
+    UniformBufferObject ubo;
+    ubo.cam_pos = glm::vec4(camera.position, float(frames_rendered % 2));
+    ubo.cam_dir = glm::vec4(camera.direction(), 0);
+    ubo.prev_cam_pos = glm::vec4(prev_camera.position, 0);
+    ubo.prev_cam_dir = glm::vec4(prev_camera.direction(), 0);
+    ubo.render_size = glm::vec4(
+        float(render_extents[current_image].width),
+        float(render_extents[current_image].height),
+        float(swap_chain_extent.width) / float(swap_chain_extent.height), 0);
+    prev_camera = camera;
+
+    // host coherent, no flush needed
+    memcpy(uniform_buffers_mapped[current_image], &ubo, sizeof(ubo));
+}
+
+void Renderer::updateCameraInput()
 {
     float speed = 0.3 * dt;
     float forward = 0;
@@ -974,26 +2404,15 @@ void Renderer::updateUniformBuffer(uint32_t current_image)
     last_xpos = xpos;
     last_ypos = ypos;
     float rot_speed = 0.005;
-    pitch -= rot_speed * dy;
-    yaw += rot_speed * dx;
-    pitch = glm::clamp(pitch, -0.49f*glm::pi<float>(), 0.49f*glm::pi<float>());
+    camera.pitch -= rot_speed * dy;
+    camera.yaw += rot_speed * dx;
+    camera.pitch = glm::clamp(camera.pitch, -0.49f * glm::pi<float>(),
+                              0.49f * glm::pi<float>());
 
-    
-
-    glm::vec3 camera_dir = glm::quat(glm::vec3(0, yaw, 0)) *
-                           glm::quat(glm::vec3(0, 0, pitch)) *
-                           glm::vec3(1, 0, 0);
+    glm::vec3 camera_dir = camera.direction();
 
     glm::vec3 side = normalize(glm::cross(glm::vec3(0, 1, 0), camera_dir));
-    camera_pos += camera_dir * forward + side * right;
-
-    glm::vec4 vectors[2] = { glm::vec4(camera_pos, 0),
-                             glm::vec4(glm::normalize(camera_dir), 0) };
-
-    void* data = device.mapMemory(uniform_buffers_memory[current_image], 0,
-                                  2 * sizeof(glm::vec4));
-    memcpy(data, &vectors, 2 * sizeof(glm::vec4));
-    device.unmapMemory(uniform_buffers_memory[current_image]);
+    camera.position += camera_dir * forward + side * right;
 }
 
 QueueFamilyIndices Renderer::findQueueFamilies(vk::PhysicalDevice device)
@@ -1010,9 +2429,12 @@ QueueFamilyIndices Renderer::findQueueFamilies(vk::PhysicalDevice device)
             indices.graphics = i;
         }
 
-        if (device.getSurfaceSupportKHR(i, surface))
+        // without a surface nothing is presented, the graphics queue
+        // stands in for the present queue
+        if (options.headless ? indices.graphics.has_value()
+                             : bool(device.getSurfaceSupportKHR(i, surface)))
         {
-            indices.present = i;
+            indices.present = options.headless ? indices.graphics.value() : i;
         }
 
         if (indices.isComplete())
@@ -1030,6 +2452,11 @@ bool Renderer::isDeviceSuitable(vk::PhysicalDevice device)
 {
     auto indices = findQueueFamilies(device);
 
+    if (options.headless)
+    {
+        return indices.isComplete();
+    }
+
     bool extensions_supported = checkDeviceExtensionSupport(device);
 
     bool swap_chain_sufficient = false;
@@ -1077,13 +2504,14 @@ Renderer::chooseSwapExtent(const vk::SurfaceCapabilitiesKHR& capabilities)
     }
 }
 
-vk::ShaderModule Renderer::createShaderModule(const std::vector<char>& code)
+vk::UniqueShaderModule
+Renderer::createShaderModule(const std::vector<char>& code)
 {
     vk::ShaderModuleCreateInfo create_info;
     create_info.codeSize = code.size();
     create_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
-    return device.createShaderModule(create_info);
+    return device.createShaderModuleUnique(create_info);
 }
 
 void Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
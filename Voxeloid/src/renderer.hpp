@@ -1,11 +1,20 @@
 #pragma once
 
+#include "camera.hpp"
+#include "camerapath.hpp"
+#include "frametimes.hpp"
+#include "frametiming.hpp"
+#include "resolutionscaler.hpp"
+#include "shadercompiler.hpp"
+#include "traversalcost.hpp"
 #include "util/timer.hpp"
 #include "voxeloctree.hpp"
 
 #include <glm/glm.hpp>
+#include <memory>
 #include <optional>
 #include <set>
+#include <string>
 #include <vulkan/vulkan.hpp>
 
 #ifdef NDEBUG
@@ -27,6 +36,97 @@ struct QueueFamilyIndices
     }
 };
 
+struct RenderOptions
+{
+    uint32_t width = 1600;
+    uint32_t height = 900;
+    // voxel file to import, the noise scene is generated when empty
+    std::string scene;
+    Camera camera;
+
+    // Render into an offscreen image instead of a window and swapchain,
+    // isRunning turns false after the given number of frames
+    bool headless = false;
+    uint32_t frames = 1;
+    // headless: the last frame is written here when not empty
+    std::string png_path;
+
+    // the camera of every frame is saved here on cleanup
+    std::string record_path;
+    // Drives the camera from a recorded path, one frame per timestep,
+    // and prints the frame times once the path is done
+    std::string play_path;
+    float timestep = 1.f / 60.f;
+
+    // Per-frame CPU and GPU timings of the last frames, written on cleanup
+    // and when F12 is pressed. CSV, or JSON for a .json extension.
+    std::string timings_path;
+
+    // Trace with shaders/shader.comp into a storage image that is blitted
+    // to the swapchain, instead of the fullscreen fragment shader. The
+    // tile is the workgroup size.
+    bool compute = false;
+    uint32_t tile_width = 8;
+    uint32_t tile_height = 8;
+
+    // Runs shaders/beam.comp first, which finds how far the rays of every
+    // 8x8 pixels can skip ahead through empty space
+    bool beam = false;
+
+    // Traces half the pixels per frame in a checkerboard and reprojects
+    // the others from the last frame, implies compute
+    bool checkerboard = false;
+
+    // The octree traversal of either shader, the STACKLESS and DDA variants
+    // for the integer cell ones
+    Traversal traversal = Traversal::Stack;
+    // DEEP variants of the integer cell traversals, which track the ray
+    // relative to the camera's finest cell for trees deeper than floats
+    // resolve, see CpuRenderer::setDeepPrecision
+    bool deep_precision = false;
+
+    // Level of detail for the integer cell traversals: nodes smaller than a
+    // pixel at their distance, scaled by 2^lod_bias, are not descended
+    // into, see CpuRenderer::setLod
+    bool lod = false;
+    float lod_bias = 0.f;
+
+    // Adapts the traced resolution each frame so the GPU time stays within
+    // the budget, scaling between min_scale and 1 per axis. Off for a zero
+    // budget. Implies compute, the storage image is scaled up in the blit.
+    float frame_budget_ms = 0.f;
+    float min_scale = 0.5f;
+
+    // steps per ray before it gives up, a specialization constant like the
+    // tree depth
+    uint32_t num_steps = 512;
+
+    // Compiled pipelines are kept here between runs, nothing is saved
+    // when empty. Deleting the file measures a cold start.
+    std::string pipeline_cache_path = "pipeline_cache.bin";
+
+    // Shows the cost of every ray as a heatmap instead of the shading, with
+    // the HEATMAP variant of shaders/shader.comp, implies compute. The
+    // histograms of all frames are printed on cleanup and written to
+    // heatmap_json when it is not empty.
+    HeatmapMetric heatmap = HeatmapMetric::None;
+    std::string heatmap_json;
+};
+
+// std140 layout of the uniform buffer in the shaders, shader.vert and
+// shader.frag only declare the first two members
+struct UniformBufferObject
+{
+    // w is the frame parity for the checkerboard
+    glm::vec4 cam_pos;
+    glm::vec4 cam_dir;
+    // the camera of the last frame
+    glm::vec4 prev_cam_pos;
+    glm::vec4 prev_cam_dir;
+    // xy the traced pixels, z the aspect of the output
+    glm::vec4 render_size;
+};
+
 struct SwapChainSupportDetails
 {
     vk::SurfaceCapabilitiesKHR capabilities;
@@ -37,7 +137,7 @@ struct SwapChainSupportDetails
 class Renderer
 {
   public:
-    void init();
+    void init(const RenderOptions& options = {});
     void cleanup();
 
     void render();
@@ -55,28 +155,70 @@ class Renderer
     void createLogicalDevice();
     void createSwapChain();
     void createImageViews();
+    void createOffscreenTarget();
     void createRenderPass();
-    void createDescriptorSetLayout();
-    void createGraphicsPipeline();
+    // only the bindings the shaders of layout_options use
+    vk::DescriptorSetLayout
+    createDescriptorSetLayout(const RenderOptions& layout_options);
+    void createPipelineCache();
+    void savePipelineCache();
+    // The layout and all pipelines of the options, in parallel. A cold
+    // pipeline cache also gets the other pipelineVariants.
+    void createPipelines();
+    vk::PipelineLayout createPipelineLayout(vk::DescriptorSetLayout set_layout);
+    // like " BEAM DDA", for the log
+    static std::string variantDefines(const RenderOptions& variant);
+    // options with every other define set of the graphics or compute
+    // shader in compile.bat, the options' own excluded
+    std::vector<RenderOptions> pipelineVariants();
+    // the defines come from variant, everything else from options, layout
+    // has to match the bindings of variant
+    vk::Pipeline createGraphicsPipeline(const RenderOptions& variant,
+                                        vk::PipelineLayout layout);
+    void createStorageImages();
+    vk::Pipeline createComputePipeline(const RenderOptions& variant,
+                                       vk::PipelineLayout layout);
+    void clearHistoryImages();
+    vk::Pipeline createBeamPipeline(vk::PipelineLayout layout);
     void createFramebuffers();
     void createCommandPool();
     void createTextureImage();
 	void createTextureImageView();
 	void createTextureSampler();
     void createUniformBuffers();
+    void createHeatmapBuffers();
     void createDescriptorPool();
     void createDescriptorSets();
     void createCommandBuffers();
+    void recordCommandBuffer(size_t image_index);
+    void recordCompute(vk::CommandBuffer command_buffer, size_t image_index);
+    void recordBeamPrepass(vk::CommandBuffer command_buffer,
+                           size_t image_index);
     void createSyncObjects();
+    void createQueryPool();
+    void calibrateTimestamps();
 
     void updateUniformBuffer(uint32_t image_index);
+    void updateCameraInput();
+
+    void renderHeadless();
+    // gpu time of the frame last rendered to the image, which must be done
+    void readTimestamps(uint32_t image_index);
+    // picks the resolution of the next frame rendered to the image from
+    // the gpu time of its last one, re-records its commands on a change
+    void updateRenderScale(uint32_t image_index);
+    float renderScale(uint32_t image_index);
+    void saveOffscreenImage(const std::string& filename);
+    // adds the cost histograms of the frame last rendered to the image,
+    // which must be done, and zeroes them so they are only counted once
+    void readHeatmap(uint32_t image_index);
 
     QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device);
     bool isDeviceSuitable(vk::PhysicalDevice device);
     SwapChainSupportDetails querySwapChainSupport(vk::PhysicalDevice device);
     vk::Extent2D
     chooseSwapExtent(const vk::SurfaceCapabilitiesKHR& capabilities);
-    vk::ShaderModule createShaderModule(const std::vector<char>& code);
+    vk::UniqueShaderModule createShaderModule(const std::vector<char>& code);
     void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                       vk::MemoryPropertyFlags properties, vk::Buffer& buffer,
                       vk::DeviceMemory& bufferMemory);
@@ -99,11 +241,34 @@ class Renderer
                                vk::ImageLayout oldLayout,
                                vk::ImageLayout newLayout);
 
+    struct StorageImage
+    {
+        vk::Image image;
+        vk::DeviceMemory memory;
+        vk::ImageView view;
+    };
+    // device local, in eUndefined layout
+    StorageImage createStorageImage(uint32_t width, uint32_t height,
+                                    vk::Format format,
+                                    vk::ImageUsageFlags usage);
+    void destroyStorageImage(StorageImage& storage_image);
+
+    // precedes the driver's data in the pipeline cache file, the data is
+    // only used when all but the size match the device
+    struct PipelineCacheHeader
+    {
+        uint32_t magic = 0x43505856; // "VXPC"
+        uint32_t vendor_id = 0;
+        uint32_t device_id = 0;
+        uint32_t driver_version = 0;
+        uint8_t uuid[VK_UUID_SIZE] = {};
+        uint64_t data_size = 0;
+    };
+    PipelineCacheHeader pipelineCacheHeader();
+
 	void copyBufferToImage3D(vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height, uint32_t depth);
 
-    glm::vec3 camera_pos;
-    float yaw = 0;
-    float pitch = 0;
+    Camera camera;
     double last_xpos, last_ypos;
 
     Timer timer;
@@ -112,7 +277,35 @@ class Renderer
     int fps_counter = 0;
     Timer fps_timer;
 
-    VoxelOctree voxels;
+    RenderOptions options;
+    uint32_t frames_rendered = 0;
+    Timer headless_timer;
+
+    CameraPath camera_path;
+    float record_time = 0.f;
+    FrameTimes frame_times;
+    Timer frame_timer;
+
+    FrameTimingLog timing_log;
+    // two timestamps around the render pass per swapchain image
+    vk::QueryPool timestamp_pool;
+    // nanoseconds per timestamp tick, zero without timestamp support
+    float timestamp_period = 0.f;
+    uint64_t timestamp_mask = 0;
+    // the frame whose timestamps the image holds
+    std::vector<uint64_t> image_frames;
+
+    // CPU time in ms since init, for latencies
+    Timer latency_clock;
+    // when the input of the frame rendered to each image was sampled
+    std::vector<double> image_input_ms;
+    // a GPU timestamp and the CPU time it was taken at
+    uint64_t calibration_ticks = 0;
+    double calibration_ms = 0;
+    bool dump_key_down = false;
+
+    std::unique_ptr<VoxelOctree> voxels;
+    std::unique_ptr<ShaderCompiler> shader_compiler;
 
     uint32_t window_width = 0;
     uint32_t window_height = 0;
@@ -141,6 +334,10 @@ class Renderer
     vk::Format swap_chain_format;
     std::vector<vk::Framebuffer> swap_chain_framebuffers;
 
+    // headless only, stands in for the single swapchain image
+    vk::Image offscreen_image;
+    vk::DeviceMemory offscreen_image_memory;
+
     vk::RenderPass render_pass;
     vk::DescriptorSetLayout descriptor_set_layout;
     vk::PipelineLayout pipeline_layout;
@@ -150,8 +347,44 @@ class Renderer
 
     vk::Pipeline graphics_pipeline;
 
+    vk::PipelineCache pipeline_cache;
+    bool pipeline_cache_loaded = false;
+    double pipelines_ms = 0;
+    // pipelines created only to fill a cold pipeline cache
+    size_t pipeline_variants = 0;
+
+    // compute path only, one storage image per swapchain image
+    vk::Pipeline compute_pipeline;
+    std::vector<StorageImage> storage_images;
+
+    // beam prepass only, a start distance per block and swapchain image
+    const uint32_t BEAM_BLOCK = 8;
+    vk::Pipeline beam_pipeline;
+    std::vector<StorageImage> beam_images;
+
+    // checkerboard only, color and hit distance, even frames write the
+    // first one
+    std::vector<StorageImage> history_images;
+    Camera prev_camera;
+
+    // the traced part of the storage image per swapchain image, the full
+    // extent unless the resolution is dynamic
+    std::vector<vk::Extent2D> render_extents;
+    ResolutionScaler resolution_scaler;
+    // linear when the storage format supports it, for upscaling
+    vk::Filter blit_filter = vk::Filter::eNearest;
+
     std::vector<vk::Buffer> uniform_buffers;
     std::vector<vk::DeviceMemory> uniform_buffers_memory;
+    // mapped for the lifetime of the buffers
+    std::vector<void*> uniform_buffers_mapped;
+
+    // heatmap only, the shader's CostHistogram counts per swapchain image,
+    // mapped like the uniform buffers
+    std::vector<vk::Buffer> heatmap_buffers;
+    std::vector<vk::DeviceMemory> heatmap_buffers_memory;
+    std::vector<void*> heatmap_buffers_mapped;
+    CostHistogram heatmap_costs;
 
     vk::Buffer staging_buffer;
     vk::DeviceMemory staging_buffer_memory;
@@ -0,0 +1,48 @@
+#include "resolutionscaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// aim below the budget, the GPU times are noisy
+const float HEADROOM = 0.9f;
+// fraction of the way to the target scale per frame, shrinking fast so
+// an expensive view misses few frames and growing slowly so the scale
+// does not oscillate
+const float SHRINK_RATE = 0.5f;
+const float GROW_RATE = 0.1f;
+// relative differences to the target below this are ignored, each change
+// re-records a command buffer and shows as a resolution pop
+const float DEADBAND = 0.02f;
+
+} // namespace
+
+ResolutionScaler::ResolutionScaler(float budget_ms, float min_scale,
+                                   float max_scale)
+    : budget_ms(budget_ms), min_scale(min_scale), max_scale(max_scale),
+      current(max_scale)
+{
+}
+
+float ResolutionScaler::update(double gpu_ms, float frame_scale)
+{
+    if (budget_ms <= 0.f || gpu_ms <= 0.0) return current;
+
+    float target = frame_scale *
+                   float(std::sqrt(HEADROOM * budget_ms / gpu_ms));
+    target = std::clamp(target, min_scale, max_scale);
+
+    // the limits are reached exactly, the deadband would stop short
+    float gap = target - current;
+    bool at_limit = target == min_scale || target == max_scale;
+    if (gap == 0.f || (!at_limit && std::abs(gap) <= DEADBAND * current))
+        return current;
+
+    // at least a deadband per step, smaller steps would stall short of it
+    float rate = gap < 0.f ? SHRINK_RATE : GROW_RATE;
+    float step = std::max(std::abs(rate * gap), DEADBAND * current);
+    current = gap < 0.f ? std::max(current - step, target)
+                        : std::min(current + step, target);
+    return current;
+}
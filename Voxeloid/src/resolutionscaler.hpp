@@ -0,0 +1,22 @@
+#pragma once
+
+// Picks the render resolution scale from the GPU times of the last frames
+// so they stay within a frame time budget. The GPU time is taken to grow
+// with the traced pixels, the square of the scale.
+class ResolutionScaler
+{
+  public:
+    ResolutionScaler() = default;
+    ResolutionScaler(float budget_ms, float min_scale, float max_scale);
+
+    // gpu_ms of a frame rendered at frame_scale, which can be older than
+    // the current scale while frames are in flight. Returns the new scale.
+    float update(double gpu_ms, float frame_scale);
+    float scale() const { return current; }
+
+  private:
+    float budget_ms = 0.f;
+    float min_scale = 1.f;
+    float max_scale = 1.f;
+    float current = 1.f;
+};
@@ -0,0 +1,155 @@
+#include "shadercompiler.hpp"
+
+#include "util/runtimeerror.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+#ifdef _WIN32
+const char* GLSLC_NAME = "glslc.exe";
+const char* NULL_DEVICE = "NUL";
+#else
+const char* GLSLC_NAME = "glslc";
+const char* NULL_DEVICE = "/dev/null";
+#endif
+
+std::vector<char> readBinary(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+    std::vector<char> buffer(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(buffer.data(), buffer.size());
+    return buffer;
+}
+
+std::string quote(const std::string& text) { return "\"" + text + "\""; }
+
+int run(const std::string& command)
+{
+#ifdef _WIN32
+    // cmd.exe strips the first and last quote of the line
+    return std::system(quote(command).c_str());
+#else
+    return std::system(command.c_str());
+#endif
+}
+
+// FNV-1a
+uint64_t hashBytes(const std::string& bytes)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : bytes)
+    {
+        hash ^= uint8_t(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+} // namespace
+
+ShaderCompiler::ShaderCompiler(const std::string& cache_dir)
+    : cache_dir(cache_dir)
+{
+    std::vector<std::string> candidates;
+    if (const char* sdk = std::getenv("VULKAN_SDK"))
+    {
+        for (const char* bin : { "Bin", "bin", "Bin32" })
+        {
+            fs::path path = fs::path(sdk) / bin / GLSLC_NAME;
+            if (fs::exists(path)) candidates.push_back(quote(path.string()));
+        }
+    }
+    candidates.push_back(GLSLC_NAME);
+
+    for (const auto& candidate : candidates)
+    {
+        std::string probe =
+            candidate + " --version > " + NULL_DEVICE + " 2>&1";
+        if (run(probe) == 0)
+        {
+            glslc = candidate;
+            break;
+        }
+    }
+    if (glslc.empty())
+    {
+        std::cout << "Warning: glslc not found, using the shaders built by "
+                     "compile.bat\n";
+    }
+}
+
+std::vector<char> ShaderCompiler::compile(
+    const std::string& source, const std::vector<std::string>& defines,
+    const std::string& offline_spv)
+{
+    if (glslc.empty())
+    {
+        if (!fs::exists(offline_spv))
+        {
+            std::string variant = source;
+            for (const auto& define : defines) variant += " -D" + define;
+            THROW_RUNTIME_ERROR("No SPIR-V for " + variant + ": " +
+                                offline_spv +
+                                " is missing and glslc was not found, "
+                                "install the Vulkan SDK or put glslc on "
+                                "the PATH, or run shaders/compile.bat");
+        }
+        return readBinary(offline_spv);
+    }
+
+    std::string args;
+    for (const auto& define : defines)
+        args += " -D" + define;
+
+    std::vector<char> text = readBinary(source);
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0')
+         << hashBytes(std::string(text.begin(), text.end()) + args + glslc)
+         << ".spv";
+    fs::path cached = fs::path(cache_dir) / name.str();
+    if (fs::exists(cached)) return readBinary(cached.string());
+
+    // An interrupted compile must not leave a broken cache entry behind.
+    // Pipelines are created in parallel, so several calls can compile the
+    // same variant at once, each into its own partial file.
+    fs::create_directories(cache_dir);
+    static std::atomic<uint64_t> num_compiles{ 0 };
+    fs::path partial = cached;
+    partial += "." + std::to_string(num_compiles++) + ".tmp";
+
+    std::cout << "Compiling " << source << args << "\n";
+    std::string command = glslc + args + " " + quote(source) + " -o " +
+                          quote(partial.string());
+    if (run(command) != 0)
+    {
+        THROW_RUNTIME_ERROR("Failed to compile '" + source + "'" + args);
+    }
+    std::error_code error;
+    fs::rename(partial, cached, error);
+    if (error)
+    {
+        // Windows can't replace a cache file that another call is reading,
+        // whoever put it there compiled the same source
+        fs::remove(partial, error);
+        if (!fs::exists(cached))
+        {
+            THROW_RUNTIME_ERROR("Failed to write '" + cached.string() + "'");
+        }
+    }
+    return readBinary(cached.string());
+}
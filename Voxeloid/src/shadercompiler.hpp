@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Compiles the GLSL variants at runtime with glslc from the Vulkan SDK,
+// which is looked up under VULKAN_SDK and then on the PATH. The SPIR-V is
+// cached in cache_dir under a hash of the source, the defines and the
+// compiler. Without glslc the SPIR-V built offline by compile.bat is used.
+class ShaderCompiler
+{
+  public:
+    ShaderCompiler(const std::string& cache_dir = "shaders/cache");
+
+    // source like "shaders/shader.comp", defines like "BEAM", offline_spv
+    // is the compile.bat output of the same variant
+    std::vector<char> compile(const std::string& source,
+                              const std::vector<std::string>& defines,
+                              const std::string& offline_spv);
+
+    bool hasCompiler() const { return !glslc.empty(); }
+
+  private:
+    std::string cache_dir;
+    // quoted command, empty without a compiler
+    std::string glslc;
+};
@@ -0,0 +1,130 @@
+#include "traversalcost.hpp"
+
+#include "util/runtimeerror.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace
+{
+const char* METRIC_NAMES[3] = { "steps", "max_depth", "fetches" };
+
+int bin(int value, int width)
+{
+    return std::clamp(value / width, 0, CostHistogram::BINS - 1);
+}
+
+int binWidth(int metric)
+{
+    // max depths are binned one by one
+    return metric == 1 ? 1 : CostHistogram::COST_BIN_WIDTH;
+}
+
+} // namespace
+
+bool parseHeatmapMetric(const std::string& name, HeatmapMetric& metric)
+{
+    if (name == "steps")
+        metric = HeatmapMetric::Steps;
+    else if (name == "depth")
+        metric = HeatmapMetric::MaxDepth;
+    else if (name == "fetches")
+        metric = HeatmapMetric::Fetches;
+    else
+        return false;
+    return true;
+}
+
+glm::vec3 heatmapColor(const TraversalCost& cost, HeatmapMetric metric,
+                       int max_depth)
+{
+    float value = 0.f;
+    if (metric == HeatmapMetric::Steps)
+        value = float(cost.steps) / HEATMAP_MAX_COST;
+    else if (metric == HeatmapMetric::MaxDepth)
+        value = float(cost.max_depth) / float(glm::max(max_depth, 1));
+    else if (metric == HeatmapMetric::Fetches)
+        value = float(cost.fetches) / HEATMAP_MAX_COST;
+    value = glm::clamp(value, 0.f, 1.f);
+
+    // dark blue, cyan, yellow, dark red
+    return glm::clamp(1.5f - glm::abs(4.f * value - glm::vec3(3, 2, 1)), 0.f,
+                      1.f);
+}
+
+void CostHistogram::add(const TraversalCost& cost)
+{
+    counts[bin(cost.steps, COST_BIN_WIDTH)]++;
+    counts[BINS + bin(cost.max_depth, 1)]++;
+    counts[2 * BINS + bin(cost.fetches, COST_BIN_WIDTH)]++;
+}
+
+void CostHistogram::add(const CostHistogram& other)
+{
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] += other.counts[i];
+}
+
+void CostHistogram::add(const uint32_t* shader_counts)
+{
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] += shader_counts[i];
+}
+
+uint64_t CostHistogram::rays() const
+{
+    uint64_t rays = 0;
+    for (int i = 0; i < BINS; i++)
+        rays += counts[i];
+    return rays;
+}
+
+void CostHistogram::printReport(std::ostream& out) const
+{
+    uint64_t total = rays();
+    out << "rays: " << total << "\n";
+    if (total == 0) return;
+
+    for (int metric = 0; metric < 3; metric++)
+    {
+        const uint64_t* bins = &counts[size_t(metric) * BINS];
+        // nearest rank, like FrameTimes
+        auto percentile = [&](double p) {
+            uint64_t rank = std::max<uint64_t>(1, uint64_t(p * total + 0.5));
+            uint64_t seen = 0;
+            for (int i = 0; i < BINS; i++)
+            {
+                seen += bins[i];
+                if (seen >= rank) return i * binWidth(metric);
+            }
+            return (BINS - 1) * binWidth(metric);
+        };
+        out << METRIC_NAMES[metric] << ": p50 " << percentile(0.5)
+            << "  p95 " << percentile(0.95) << "  max " << percentile(1.0)
+            << "\n";
+    }
+}
+
+void CostHistogram::writeJSON(const std::string& filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    file << "{\n  \"rays\": " << rays() << ",\n";
+    for (int metric = 0; metric < 3; metric++)
+    {
+        // bins start at i * bin_width, the last one is open ended
+        file << "  \"" << METRIC_NAMES[metric] << "\": {\"bin_width\": "
+             << binWidth(metric) << ", \"counts\": [";
+        for (int i = 0; i < BINS; i++)
+        {
+            file << counts[size_t(metric) * BINS + i]
+                 << (i + 1 < BINS ? ", " : "");
+        }
+        file << "]}" << (metric < 2 ? ",\n" : "\n");
+    }
+    file << "}\n";
+}
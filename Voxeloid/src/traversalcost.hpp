@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// The octree traversals of the shaders and CpuRenderer. Stack is the
+// original one in floats, the others track the ray by the integer
+// coordinates of its finest cell and compute the exit of every node from
+// its exact planes.
+enum class Traversal
+{
+    Stack,
+    // every lookup restarts from the root, STACKLESS shader variants
+    Stackless,
+    // a stack of the nodes above the ray, resumed at the deepest node that
+    // also holds the next cell, DDA shader variants
+    Dda
+};
+
+// What the traversal of one ray did
+struct TraversalCost
+{
+    // loop iterations, at most NUM_STEPS
+    int steps = 0;
+    // reads of the indirect texture
+    int fetches = 0;
+    // deepest level looked up, the root is 0
+    int max_depth = 0;
+};
+
+// What the heatmap render mode shows instead of the shading
+enum class HeatmapMetric
+{
+    None,
+    Steps,
+    MaxDepth,
+    Fetches
+};
+
+// "steps", "depth" or "fetches", false for anything else
+bool parseHeatmapMetric(const std::string& name, HeatmapMetric& metric);
+
+// Blue for cheap rays to red for expensive ones. Steps and fetches
+// saturate at HEATMAP_MAX_COST, depths at max_depth. Same ramp as the
+// HEATMAP variant of shaders/shader.comp.
+constexpr int HEATMAP_MAX_COST = 128;
+glm::vec3 heatmapColor(const TraversalCost& cost, HeatmapMetric metric,
+                       int max_depth);
+
+// Histograms of the per-ray costs of any number of frames. The counts are
+// laid out like the buffer of the HEATMAP shader variant: BINS of steps,
+// then of max depths, then of fetches.
+class CostHistogram
+{
+  public:
+    constexpr static int BINS = 64;
+    // steps and fetches per bin, depths get one each. The last bin holds
+    // everything above.
+    constexpr static int COST_BIN_WIDTH = 8;
+
+    void add(const TraversalCost& cost);
+    void add(const CostHistogram& other);
+    // 3 * BINS counts as written by the shader
+    void add(const uint32_t* shader_counts);
+
+    uint64_t rays() const;
+
+    // rays, and p50, p95 and max of each metric as the lowest value of
+    // their bins
+    void printReport(std::ostream& out) const;
+    void writeJSON(const std::string& filename) const;
+
+  private:
+    std::array<uint64_t, 3 * BINS> counts{};
+};
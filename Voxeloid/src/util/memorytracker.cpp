@@ -0,0 +1,79 @@
+#include "memorytracker.hpp"
+
+namespace memory
+{
+namespace
+{
+Counters counters[size_t(MemoryCategory::Count)];
+
+} // namespace
+
+const char* categoryName(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MemoryCategory::GenMaps: return "gen_maps";
+    case MemoryCategory::Nodes: return "nodes";
+    case MemoryCategory::IndirectTexture: return "indirect_texture";
+    case MemoryCategory::Staging: return "staging";
+    default: return "unknown";
+    }
+}
+
+void Counters::add(size_t bytes, bool single)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (single) single_live.fetch_add(bytes, std::memory_order_relaxed);
+    size_t now = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    // the generation tasks allocate concurrently
+    size_t old_peak = peak.load(std::memory_order_relaxed);
+    while (now > old_peak &&
+           !peak.compare_exchange_weak(old_peak, now,
+                                       std::memory_order_relaxed))
+    {
+    }
+}
+
+void Counters::remove(size_t bytes, bool single)
+{
+    if (single) single_live.fetch_sub(bytes, std::memory_order_relaxed);
+    live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+Usage Counters::usage() const
+{
+    Usage result;
+    result.live = live.load(std::memory_order_relaxed);
+    result.peak = peak.load(std::memory_order_relaxed);
+    result.allocations = allocations.load(std::memory_order_relaxed);
+    return result;
+}
+
+void Counters::resetPeak()
+{
+    peak.store(live.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+}
+
+void add(MemoryCategory category, size_t bytes)
+{
+    counters[size_t(category)].add(bytes);
+}
+
+void remove(MemoryCategory category, size_t bytes)
+{
+    counters[size_t(category)].remove(bytes);
+}
+
+void resetPeak(MemoryCategory category)
+{
+    counters[size_t(category)].resetPeak();
+}
+
+Usage usage(MemoryCategory category)
+{
+    return counters[size_t(category)].usage();
+}
+
+} // namespace memory
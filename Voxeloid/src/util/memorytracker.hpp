@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+// Live and peak bytes per data structure, counted by TrackingAllocator or
+// by explicit add/remove calls for memory not owned by a container. The
+// category counters are process-wide, a TrackingAllocator can also count
+// into the Counters of one owner.
+enum class MemoryCategory
+{
+    GenMaps,
+    Nodes,
+    IndirectTexture,
+    Staging,
+    Count
+};
+
+namespace memory
+{
+struct Usage
+{
+    size_t live = 0;
+    size_t peak = 0;
+    uint64_t allocations = 0;
+};
+
+// bytes of one category, or of one owner's containers
+class Counters
+{
+  public:
+    // single counts allocations of one element
+    void add(size_t bytes, bool single = false);
+    void remove(size_t bytes, bool single = false);
+    Usage usage() const;
+    void resetPeak();
+    // live bytes of single element allocations, for node based containers
+    // the nodes without their bucket array
+    size_t singleLive() const
+    {
+        return single_live.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<size_t> live{ 0 };
+    std::atomic<size_t> peak{ 0 };
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<size_t> single_live{ 0 };
+};
+
+const char* categoryName(MemoryCategory category);
+
+void add(MemoryCategory category, size_t bytes);
+void remove(MemoryCategory category, size_t bytes);
+Usage usage(MemoryCategory category);
+// starts a new peak measurement from the live bytes
+void resetPeak(MemoryCategory category);
+
+} // namespace memory
+
+template <class T, MemoryCategory C>
+struct TrackingAllocator
+{
+    using value_type = T;
+
+    template <class U>
+    struct rebind
+    {
+        using other = TrackingAllocator<U, C>;
+    };
+
+    // the owner's counters go along when a container is moved or swapped
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    TrackingAllocator() = default;
+    explicit TrackingAllocator(memory::Counters* owner) : owner(owner) {}
+    template <class U>
+    TrackingAllocator(const TrackingAllocator<U, C>& other)
+        : owner(other.owner)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        memory::add(C, n * sizeof(T));
+        if (owner) owner->add(n * sizeof(T), n == 1);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        memory::remove(C, n * sizeof(T));
+        if (owner) owner->remove(n * sizeof(T), n == 1);
+        ::operator delete(p);
+    }
+
+    template <class U>
+    bool operator==(const TrackingAllocator<U, C>& other) const
+    {
+        return owner == other.owner;
+    }
+    template <class U>
+    bool operator!=(const TrackingAllocator<U, C>& other) const
+    {
+        return owner != other.owner;
+    }
+
+    // also counts into these when set
+    memory::Counters* owner = nullptr;
+};
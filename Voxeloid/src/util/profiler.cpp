@@ -0,0 +1,126 @@
+#include "profiler.hpp"
+
+#include "runtimeerror.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace profiler
+{
+namespace detail
+{
+std::atomic<bool> enabled{ false };
+
+struct ThreadBuffer
+{
+    constexpr static size_t CAPACITY = 1 << 16;
+
+    uint32_t thread_index = 0;
+    // only the owning thread writes, the exporter reads [0, count)
+    std::atomic<size_t> count{ 0 };
+    std::atomic<size_t> dropped{ 0 };
+    std::unique_ptr<Event[]> events{ new Event[CAPACITY] };
+};
+
+namespace
+{
+std::mutex registry_mutex;
+// buffers outlive their threads so zones of finished tasks are exported
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+// buffers of finished threads, there are never more buffers than threads
+// alive at once
+std::vector<ThreadBuffer*> free_buffers;
+const Clock::time_point epoch_time = Clock::now();
+const uint64_t epoch_ticks = ticks();
+
+} // namespace
+
+ThreadBuffer* acquireBuffer()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (!free_buffers.empty())
+    {
+        ThreadBuffer* buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
+    }
+    registry.push_back(std::make_unique<ThreadBuffer>());
+    registry.back()->thread_index = uint32_t(registry.size() - 1);
+    return registry.back().get();
+}
+
+void releaseBuffer(ThreadBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    free_buffers.push_back(buffer);
+}
+
+void record(ThreadBuffer* buffer, const Event& event)
+{
+    size_t i = buffer->count.load(std::memory_order_relaxed);
+    if (i == ThreadBuffer::CAPACITY)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[i] = event;
+    buffer->count.store(i + 1, std::memory_order_release);
+}
+
+} // namespace detail
+
+void setEnabled(bool enabled)
+{
+    detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+void writeChromeTrace(const std::string& filename)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    // ticks per microsecond over the whole run since startup
+    double elapsed_us = std::chrono::duration<double, std::micro>(
+                            Clock::now() - detail::epoch_time)
+                            .count();
+    double ticks_per_us =
+        double(ticks() - detail::epoch_ticks) / std::max(elapsed_us, 1.0);
+    auto micros = [&](uint64_t time) {
+        return double(int64_t(time - detail::epoch_ticks)) / ticks_per_us;
+    };
+
+    std::lock_guard<std::mutex> lock(detail::registry_mutex);
+
+    file << "{\"traceEvents\": [\n";
+    bool first = true;
+    size_t dropped = 0;
+    file.precision(3);
+    file << std::fixed;
+    for (auto& buffer : detail::registry)
+    {
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; i++)
+        {
+            const detail::Event& event = buffer->events[i];
+            if (!first) file << ",\n";
+            first = false;
+            file << "{\"name\": \"" << event.name
+                 << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+                 << buffer->thread_index << ", \"ts\": " << micros(event.start)
+                 << ", \"dur\": " << micros(event.end) - micros(event.start)
+                 << "}";
+        }
+    }
+    file << "\n],\n\"otherData\": {\"dropped_zones\": " << dropped << "}}\n";
+}
+
+} // namespace profiler
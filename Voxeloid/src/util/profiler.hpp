@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Scoped profiler zones, exported as Chrome trace events
+// (chrome://tracing or https://ui.perfetto.dev).
+//
+//   void work()
+//   {
+//       PROFILE_SCOPE("work");
+//       ...
+//   }
+//
+// Zones are only recorded after setEnabled(true). Every thread appends to
+// its own fixed-size buffer, so recording a zone takes no lock and
+// allocates nothing. A finished thread hands its buffer on to the next new
+// thread, which appends after the events already in it, so short-lived
+// worker threads don't add buffers. Zone names must be string literals or
+// otherwise outlive the export. Zones after a buffer is full are dropped
+// and counted. On x86 zones are timed with the TSC, which is converted to
+// microseconds against the clock at export.
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) \
+    ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+namespace profiler
+{
+using Clock = std::chrono::high_resolution_clock;
+
+inline uint64_t ticks()
+{
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now().time_since_epoch())
+                        .count());
+#endif
+}
+
+// zones are recorded while enabled, off by default
+void setEnabled(bool enabled);
+bool isEnabled();
+
+void writeChromeTrace(const std::string& filename);
+
+namespace detail
+{
+extern std::atomic<bool> enabled;
+
+struct Event
+{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+// takes a free buffer or registers a new one, takes a lock
+struct ThreadBuffer* acquireBuffer();
+// makes the buffer free for the next thread, its events are kept
+void releaseBuffer(ThreadBuffer* buffer);
+void record(ThreadBuffer* buffer, const Event& event);
+
+// holds the buffer of a thread from its first zone until it exits
+struct ThreadOwner
+{
+    ThreadBuffer* buffer = acquireBuffer();
+    ~ThreadOwner() { releaseBuffer(buffer); }
+};
+
+inline ThreadBuffer* threadBuffer()
+{
+    thread_local ThreadOwner owner;
+    return owner.buffer;
+}
+
+} // namespace detail
+} // namespace profiler
+
+class ProfileZone
+{
+  public:
+    explicit ProfileZone(const char* name)
+        : name(profiler::detail::enabled.load(std::memory_order_relaxed)
+                   ? name
+                   : nullptr)
+    {
+        if (this->name) start = profiler::ticks();
+    }
+
+    ~ProfileZone()
+    {
+        if (!name) return;
+        profiler::detail::record(profiler::detail::threadBuffer(),
+                                 { name, start, profiler::ticks() });
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+  private:
+    const char* name;
+    uint64_t start = 0;
+};
@@ -1,4 +1,7 @@
 #pragma once
 
+#include <stdexcept>
+#include <string>
+
 #define THROW_RUNTIME_ERROR(msg) \
-    throw std::runtime_error(__FUNCTION__ ":\n\t" msg);
\ No newline at end of file
+    throw std::runtime_error(std::string(__FUNCTION__) + ":\n\t" + msg);
@@ -0,0 +1,268 @@
+#include "voxelimport.hpp"
+
+#include "util/runtimeerror.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+uint8_t depthForSize(uint32_t size)
+{
+    uint8_t depth = 1;
+    while ((uint32_t(1) << depth) < size)
+        depth++;
+    return depth;
+}
+
+uint32_t readU32(std::ifstream& file)
+{
+    uint8_t bytes[4] = {};
+    file.read(reinterpret_cast<char*>(bytes), 4);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+           (uint32_t(bytes[3]) << 24);
+}
+
+std::string readChunkId(std::ifstream& file)
+{
+    char id[4] = {};
+    file.read(id, 4);
+    return std::string(id, 4);
+}
+
+VoxelGrid quantizePoints(const std::vector<glm::dvec3>& points, uint8_t depth)
+{
+    VoxelGrid grid;
+    grid.depth = depth;
+    if (points.empty())
+    {
+        return grid;
+    }
+
+    glm::dvec3 min_point = points[0];
+    glm::dvec3 max_point = points[0];
+    for (auto& point : points)
+    {
+        min_point = glm::min(min_point, point);
+        max_point = glm::max(max_point, point);
+    }
+
+    double extent = glm::max(max_point.x - min_point.x,
+                             glm::max(max_point.y - min_point.y,
+                                      max_point.z - min_point.z));
+    double side = double(uint32_t(1) << depth);
+    double scale = extent > 0.0 ? (side - 1.0) / extent : 0.0;
+
+    grid.voxels.reserve(points.size());
+    for (auto& point : points)
+    {
+        glm::dvec3 cell = glm::floor((point - min_point) * scale + 0.5);
+        grid.voxels.push_back(glm::clamp(glm::uvec3(cell), glm::uvec3(0),
+                                         glm::uvec3(side - 1.0)));
+    }
+    return grid;
+}
+
+} // namespace
+
+VoxelGrid importVox(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    if (readChunkId(file) != "VOX ")
+    {
+        THROW_RUNTIME_ERROR("Not a MagicaVoxel file: '" + filename + "'");
+    }
+    readU32(file); // version
+
+    if (readChunkId(file) != "MAIN")
+    {
+        THROW_RUNTIME_ERROR("Missing MAIN chunk: '" + filename + "'");
+    }
+    // MAIN has no content of its own, the models are its children
+    file.seekg(8, std::ios::cur);
+
+    VoxelGrid grid;
+    glm::uvec3 size{ 0 };
+    while (file)
+    {
+        std::string id = readChunkId(file);
+        uint32_t content_size = readU32(file);
+        uint32_t children_size = readU32(file);
+        if (!file)
+        {
+            break;
+        }
+
+        if (id == "SIZE")
+        {
+            size.x = readU32(file);
+            size.y = readU32(file);
+            size.z = readU32(file);
+            file.seekg(content_size - 12 + children_size, std::ios::cur);
+        }
+        else if (id == "XYZI")
+        {
+            uint32_t num_voxels = readU32(file);
+            std::vector<uint8_t> data(4 * size_t(num_voxels));
+            file.read(reinterpret_cast<char*>(data.data()), data.size());
+
+            uint32_t max_size = glm::max(size.x, glm::max(size.y, size.z));
+            grid.depth = depthForSize(max_size);
+            grid.voxels.reserve(num_voxels);
+            for (size_t i = 0; i < data.size(); i += 4)
+            {
+                // z-up to y-up, a rotation about x keeps the handedness
+                grid.voxels.push_back(
+                    { data[i + 0], data[i + 2], size.y - 1 - data[i + 1] });
+            }
+            break;
+        }
+        else
+        {
+            file.seekg(content_size + children_size, std::ios::cur);
+        }
+    }
+
+    if (grid.depth == 0)
+    {
+        THROW_RUNTIME_ERROR("No voxel model found in: '" + filename + "'");
+    }
+    return grid;
+}
+
+VoxelGrid importXYZ(const std::string& filename, uint8_t depth)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    std::vector<glm::dvec3> points;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream stream(line);
+        glm::dvec3 point;
+        if (stream >> point.x >> point.y >> point.z)
+        {
+            points.push_back(point);
+        }
+    }
+    return quantizePoints(points, depth);
+}
+
+VoxelGrid importPLY(const std::string& filename, uint8_t depth)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        THROW_RUNTIME_ERROR("Failed to open file: '" + filename + "'");
+    }
+
+    std::string line;
+    std::getline(file, line);
+    if (line.compare(0, 3, "ply") != 0)
+    {
+        THROW_RUNTIME_ERROR("Not a PLY file: '" + filename + "'");
+    }
+
+    // lines of the elements declared before "vertex" are skipped
+    size_t lines_before_vertices = 0;
+    size_t num_vertices = 0;
+    int x_index = -1, y_index = -1, z_index = -1;
+    int num_properties = 0;
+    bool in_vertex = false;
+    bool vertex_found = false;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "format")
+        {
+            std::string format;
+            stream >> format;
+            if (format != "ascii")
+            {
+                THROW_RUNTIME_ERROR("Only ASCII PLY is supported: '" +
+                                    filename + "'");
+            }
+        }
+        else if (keyword == "element")
+        {
+            std::string name;
+            size_t count = 0;
+            stream >> name >> count;
+            in_vertex = name == "vertex";
+            if (in_vertex)
+            {
+                num_vertices = count;
+                vertex_found = true;
+            }
+            else if (!vertex_found)
+            {
+                lines_before_vertices += count;
+            }
+        }
+        else if (keyword == "property" && in_vertex)
+        {
+            std::string type, name;
+            stream >> type >> name;
+            if (name == "x") x_index = num_properties;
+            if (name == "y") y_index = num_properties;
+            if (name == "z") z_index = num_properties;
+            num_properties++;
+        }
+        else if (keyword == "end_header")
+        {
+            break;
+        }
+    }
+
+    if (x_index < 0 || y_index < 0 || z_index < 0)
+    {
+        THROW_RUNTIME_ERROR("PLY vertices lack x, y or z: '" + filename + "'");
+    }
+
+    for (size_t i = 0; i < lines_before_vertices; i++)
+        std::getline(file, line);
+
+    std::vector<glm::dvec3> points;
+    points.reserve(num_vertices);
+    std::vector<double> values(num_properties);
+    for (size_t i = 0; i < num_vertices && std::getline(file, line); i++)
+    {
+        std::istringstream stream(line);
+        for (auto& value : values)
+            stream >> value;
+        if (!stream) continue;
+
+        points.push_back({ values[x_index], values[y_index], values[z_index] });
+    }
+    return quantizePoints(points, depth);
+}
+
+VoxelGrid importVoxels(const std::string& filename, uint8_t point_depth)
+{
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](char c) { return char(tolower(c)); });
+
+    if (extension == "vox") return importVox(filename);
+    if (extension == "xyz") return importXYZ(filename, point_depth);
+    if (extension == "ply") return importPLY(filename, point_depth);
+
+    THROW_RUNTIME_ERROR("Unknown voxel file type: '" + filename + "'");
+}
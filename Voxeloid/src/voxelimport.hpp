@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Voxel cell coordinates in [0, 2^depth), ready for the VoxelOctree bulk
+// constructor
+struct VoxelGrid
+{
+    uint8_t depth = 0;
+    std::vector<glm::uvec3> voxels;
+};
+
+// MagicaVoxel .vox, only the first model is imported. MagicaVoxel is z-up,
+// the model is rotated about x to the renderer's y-up: (x, z, size.y - 1 - y).
+VoxelGrid importVox(const std::string& filename);
+
+// Point clouds are scaled uniformly to fit a grid of side 2^depth
+VoxelGrid importXYZ(const std::string& filename, uint8_t depth);
+// ASCII PLY only, uses the x, y and z properties of the vertex element
+VoxelGrid importPLY(const std::string& filename, uint8_t depth);
+
+// Picks the importer from the file extension
+VoxelGrid importVoxels(const std::string& filename, uint8_t point_depth = 8);
@@ -1,9 +1,20 @@
 #include "voxeloctree.hpp"
 
+#include "util/profiler.hpp"
+#include "util/runtimeerror.hpp"
+#include "util/timer.hpp"
+
+#include <algorithm>
 #include <bitset>
 #include <future>
 #include <glm/gtc/noise.hpp>
 #include <iostream>
+#include <random>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 size_t VoxelOctree::textureIndex(glm::ivec3 i)
 {
@@ -51,7 +62,9 @@ bool VoxelOctree::isVoxel(glm::vec3 pos)
 
     uint8_t last_child_exists = 0;
     uint8_t my_loc = 0;
-    for (int i = 0; i < MAX_DEPTH; i++)
+    // voxels at max_depth are never stored, the extra iteration checks the
+    // child bit of their parent
+    for (int i = 0; i <= max_depth; i++)
     {
         uint8_t child_loc = 0;
         for (int j = 0; j < 3; j++)
@@ -111,7 +124,7 @@ bool VoxelOctree::isVoxel2(glm::vec3 pos)
     glm::vec3 center{ 0 };
     glm::ivec3 current_cell{ 0 };
 
-    for (int i = 0; i <= MAX_DEPTH; i++)
+    for (int i = 0; i <= max_depth; i++)
     {
         glm::vec3 dir = pos - center;
         glm::ivec3 offset{ 0 };
@@ -126,7 +139,7 @@ bool VoxelOctree::isVoxel2(glm::vec3 pos)
         case INDIRECT_LEAF: return true;
         case INDIRECT_EMPTY: return false;
         }
-        // is INDIRECT_NODE, keep going
+        // is a node, keep going
 
 		glm::vec3 sgn = glm::lessThan(glm::vec3(0), dir);
         center += pos_offset * (sgn*2.f - 1.f);
@@ -138,13 +151,561 @@ bool VoxelOctree::isVoxel2(glm::vec3 pos)
     return false;
 }
 
-glm::vec3 VoxelOctree::calcPos(uint32_t loc_code)
+bool VoxelOctree::Cursor::isVoxel(glm::vec3 pos)
+{
+    if (glm::any(glm::lessThan(glm::vec3(1), glm::abs(pos))))
+    {
+        // outside octree
+        return false;
+    }
+
+    const int max_depth = octree.max_depth;
+
+    // Finest cell of pos. VoxelOctree::isVoxel goes to the upper child when
+    // pos is strictly above the node center, so a position on a cell
+    // boundary belongs to the lower cell. Scaling by a power of two is exact.
+    const int half = 1 << (max_depth - 1);
+    const int last_cell = 2 * half - 1;
+    glm::ivec3 cell = glm::ivec3(glm::ceil(pos * float(half))) + half - 1;
+    cell = glm::clamp(cell, glm::ivec3(0), glm::ivec3(last_cell));
+
+    // child of the node at level i on the path to cell
+    auto childLoc = [&](int i) {
+        int bit = max_depth - 1 - i;
+        return uint8_t(((cell.x >> bit) & 1) | ((cell.y >> bit) & 1) << 1 |
+                       ((cell.z >> bit) & 1) << 2);
+    };
+
+    // the two paths share the levels above the highest differing bit
+    glm::ivec3 diff = cell ^ last_cell_pos;
+    int diff_bits = diff.x | diff.y | diff.z;
+    int common = diff_bits == 0 ? max_depth
+                                : max_depth - 1 - glm::findMSB(diff_bits);
+    // the last query went on past the levels above its last cached level,
+    // and so does this one for the levels it shares with it
+    int start = glm::max(0, glm::min(common, num_cached - 1));
+    num_cached = glm::min(num_cached, common + 1);
+    last_cell_pos = cell;
+
+    for (int i = start; i <= max_depth; i++)
+    {
+        if (i >= num_cached)
+        {
+            levels[i].loc =
+                i == 0 ? 1 : (levels[i - 1].loc << 3) | childLoc(i - 1);
+            auto iter = octree.nodes.find(levels[i].loc);
+            levels[i].found = iter != octree.nodes.end();
+            levels[i].child_exits = levels[i].found ? iter->second.child_exits
+                                                    : 0;
+            num_cached = i + 1;
+        }
+
+        if (!levels[i].found)
+        {
+            // a missing child of an existing node is full
+            return i > 0 &&
+                   (levels[i - 1].child_exits & (1 << childLoc(i - 1)));
+        }
+
+        if (i < max_depth && (levels[i].child_exits & (1 << childLoc(i))) == 0)
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void VoxelOctree::isVoxelBatch(const glm::vec3* positions, size_t count,
+                               uint64_t* result)
+{
+    for (size_t i = 0; i < (count + 63) / 64; i++)
+        result[i] = 0;
+
+    for (size_t i = 0; i < count; i += 8)
+    {
+        int lanes = int(glm::min<size_t>(8, count - i));
+        uint64_t mask = isVoxel8(positions + i, lanes);
+        result[i / 64] |= mask << (i % 64);
+    }
+}
+
+std::vector<uint64_t>
+VoxelOctree::isVoxelBatch(const std::vector<glm::vec3>& positions)
+{
+    std::vector<uint64_t> result((positions.size() + 63) / 64);
+    isVoxelBatch(positions.data(), positions.size(), result.data());
+    return result;
+}
+
+uint8_t VoxelOctree::isVoxel8(const glm::vec3* positions, int count)
+{
+#ifdef __AVX2__
+    alignas(32) float xs[8], ys[8], zs[8];
+    for (int i = 0; i < 8; i++)
+    {
+        // padding lanes are placed outside the octree
+        glm::vec3 pos = i < count ? positions[i] : glm::vec3(2);
+        xs[i] = pos.x;
+        ys[i] = pos.y;
+        zs[i] = pos.z;
+    }
+    __m256 px = _mm256_load_ps(xs);
+    __m256 py = _mm256_load_ps(ys);
+    __m256 pz = _mm256_load_ps(zs);
+
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 one = _mm256_set1_ps(1.f);
+    auto in_range = [&](__m256 p) {
+        return _mm256_cmp_ps(_mm256_and_ps(p, abs_mask), one, _CMP_LE_OQ);
+    };
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(in_range(px), in_range(py)),
+                                  in_range(pz));
+    __m256i active = _mm256_castps_si256(inside);
+
+    const int side = int(tex_side_length);
+    const __m256i side_vec = _mm256_set1_epi32(side);
+    const __m256i side2_vec = _mm256_set1_epi32(side * side);
+    const __m256i ones = _mm256_set1_epi32(1);
+    const __m256i byte_mask = _mm256_set1_epi32(255);
+    const int* texels = reinterpret_cast<const int*>(indirect_texture.data());
+
+    __m256 cx = _mm256_setzero_ps();
+    __m256 cy = _mm256_setzero_ps();
+    __m256 cz = _mm256_setzero_ps();
+    __m256i cell_x = _mm256_setzero_si256();
+    __m256i cell_y = _mm256_setzero_si256();
+    __m256i cell_z = _mm256_setzero_si256();
+    float pos_offset = 0.5f;
+
+    uint8_t result = 0;
+    for (int i = 0; i <= max_depth && !_mm256_testz_si256(active, active); i++)
+    {
+        __m256i ox = _mm256_and_si256(
+            _mm256_castps_si256(_mm256_cmp_ps(px, cx, _CMP_GT_OQ)), ones);
+        __m256i oy = _mm256_and_si256(
+            _mm256_castps_si256(_mm256_cmp_ps(py, cy, _CMP_GT_OQ)), ones);
+        __m256i oz = _mm256_and_si256(
+            _mm256_castps_si256(_mm256_cmp_ps(pz, cz, _CMP_GT_OQ)), ones);
+
+        __m256i tx = _mm256_add_epi32(_mm256_slli_epi32(cell_x, 1), ox);
+        __m256i ty = _mm256_add_epi32(_mm256_slli_epi32(cell_y, 1), oy);
+        __m256i tz = _mm256_add_epi32(_mm256_slli_epi32(cell_z, 1), oz);
+        __m256i index = _mm256_add_epi32(
+            tx, _mm256_add_epi32(_mm256_mullo_epi32(ty, side_vec),
+                                 _mm256_mullo_epi32(tz, side2_vec)));
+
+        // one texel is 4 bytes, gather them as ints
+        __m256i texel = _mm256_mask_i32gather_epi32(
+            _mm256_setzero_si256(), texels, index, active, 4);
+        __m256i node_info = _mm256_srli_epi32(texel, 24);
+
+        __m256i is_leaf =
+            _mm256_cmpeq_epi32(node_info, _mm256_set1_epi32(INDIRECT_LEAF));
+        __m256i is_empty =
+            _mm256_cmpeq_epi32(node_info, _mm256_set1_epi32(INDIRECT_EMPTY));
+        __m256i leaf = _mm256_and_si256(active, is_leaf);
+        __m256i node = _mm256_andnot_si256(
+            _mm256_or_si256(is_leaf, is_empty), active);
+        result |= uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(leaf)));
+        active = node;
+
+        cell_x = _mm256_and_si256(texel, byte_mask);
+        cell_y = _mm256_and_si256(_mm256_srli_epi32(texel, 8), byte_mask);
+        cell_z = _mm256_and_si256(_mm256_srli_epi32(texel, 16), byte_mask);
+
+        // center += pos_offset * (offset * 2 - 1)
+        auto step = [&](__m256i o) {
+            __m256i sgn = _mm256_sub_epi32(_mm256_slli_epi32(o, 1), ones);
+            return _mm256_mul_ps(_mm256_set1_ps(pos_offset),
+                                 _mm256_cvtepi32_ps(sgn));
+        };
+        cx = _mm256_add_ps(cx, step(ox));
+        cy = _mm256_add_ps(cy, step(oy));
+        cz = _mm256_add_ps(cz, step(oz));
+        pos_offset *= 0.5f;
+
+        // the 2x2x2 texels of the next cells span 4 rows of the texture
+        alignas(32) int next[8];
+        __m256i base = _mm256_add_epi32(
+            _mm256_slli_epi32(cell_x, 1),
+            _mm256_add_epi32(
+                _mm256_mullo_epi32(_mm256_slli_epi32(cell_y, 1), side_vec),
+                _mm256_mullo_epi32(_mm256_slli_epi32(cell_z, 1), side2_vec)));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(next), base);
+        int prefetch_mask = _mm256_movemask_ps(_mm256_castsi256_ps(active));
+        for (int lane = 0; lane < 8; lane++)
+        {
+            if ((prefetch_mask & (1 << lane)) == 0) continue;
+            auto row = reinterpret_cast<const char*>(texels + next[lane]);
+            _mm_prefetch(row, _MM_HINT_T0);
+            _mm_prefetch(row + 4 * side, _MM_HINT_T0);
+            _mm_prefetch(row + 4 * side * side, _MM_HINT_T0);
+            _mm_prefetch(row + 4 * (side + side * side), _MM_HINT_T0);
+        }
+    }
+    return result;
+#else
+    uint8_t result = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (isVoxel2(positions[i])) result |= 1 << i;
+    }
+    return result;
+#endif
+}
+
+bool VoxelOctree::initRay(glm::vec3 origin, glm::vec3 dir, float max_t,
+                          RayState& ray, glm::vec3& t0, glm::vec3& t1)
+{
+    ray.origin = origin;
+    ray.dir = dir;
+    ray.max_t = max_t;
+    ray.mirror = 0;
+
+    // the octree is symmetric around 0, mirror it so that dir is positive
+    glm::vec3 mirrored_ori = origin;
+    glm::vec3 mirrored_dir = dir;
+    for (int j = 0; j < 3; j++)
+    {
+        if (mirrored_dir[j] < 0)
+        {
+            mirrored_ori[j] = -mirrored_ori[j];
+            mirrored_dir[j] = -mirrored_dir[j];
+            ray.mirror |= 1 << j;
+        }
+        mirrored_dir[j] = glm::max(mirrored_dir[j], 1e-20f);
+    }
+
+    t0 = (glm::vec3(-1) - mirrored_ori) / mirrored_dir;
+    t1 = (glm::vec3(1) - mirrored_ori) / mirrored_dir;
+
+    float t_enter = glm::max(t0.x, glm::max(t0.y, t0.z));
+    float t_exit = glm::min(t1.x, glm::min(t1.y, t1.z));
+    return t_enter < t_exit && t_exit >= 0 && t_enter <= max_t;
+}
+
+RayHit VoxelOctree::raycast(glm::vec3 origin, glm::vec3 dir, float max_t)
+{
+    RayState ray;
+    glm::vec3 t0, t1;
+    RayHit hit;
+    if (initRay(origin, dir, max_t, ray, t0, t1))
+    {
+        raycastNode(ray, glm::ivec3(0), 1, t0, t1, hit);
+    }
+    return hit;
+}
+
+void VoxelOctree::setHit(const RayState& ray, glm::ivec3 cell, LocCode loc,
+                         uint8_t child, glm::vec3 c0, RayHit& hit)
+{
+    float c_enter = glm::max(c0.x, glm::max(c0.y, c0.z));
+
+    hit.hit = true;
+    hit.t = glm::max(c_enter, 0.f);
+    hit.position = ray.origin + hit.t * ray.dir;
+    hit.normal = glm::vec3(0);
+    if (c_enter > 0)
+    {
+        int axis = c0.x == c_enter ? 0 : (c0.y == c_enter ? 1 : 2);
+        hit.normal[axis] = ray.dir[axis] > 0 ? -1.f : 1.f;
+    }
+
+    // full nodes are stored as a cell of 8 leaves
+    bool full = true;
+    for (int i = 0; i < 8 && full; i++)
+    {
+        glm::ivec3 offset{ i & 1, (i >> 1) & 1, (i >> 2) & 1 };
+        full = indirect_texture[textureIndex(2 * cell + offset) + 3] ==
+               INDIRECT_LEAF;
+    }
+    hit.loc = full ? loc : (loc << 3) | child;
+}
+
+bool VoxelOctree::raycastNode(const RayState& ray, glm::ivec3 cell,
+                              LocCode loc, glm::vec3 t0, glm::vec3 t1,
+                              RayHit& hit)
+{
+    glm::vec3 tm = 0.5f * (t0 + t1);
+    float t_enter = glm::max(t0.x, glm::max(t0.y, t0.z));
+
+    // child containing the entry point, in mirrored space
+    uint8_t child = 0;
+    for (int j = 0; j < 3; j++)
+        if (tm[j] < t_enter) child |= 1 << j;
+
+    while (true)
+    {
+        glm::vec3 c0, c1;
+        for (int j = 0; j < 3; j++)
+        {
+            bool upper = child & (1 << j);
+            c0[j] = upper ? tm[j] : t0[j];
+            c1[j] = upper ? t1[j] : tm[j];
+        }
+        float c_enter = glm::max(c0.x, glm::max(c0.y, c0.z));
+        float c_exit = glm::min(c1.x, glm::min(c1.y, c1.z));
+
+        if (c_enter > ray.max_t)
+        {
+            return false;
+        }
+
+        if (c_exit >= 0)
+        {
+            uint8_t real_child = child ^ ray.mirror;
+            glm::ivec3 offset{ real_child & 1, (real_child >> 1) & 1,
+                               (real_child >> 2) & 1 };
+            size_t index = textureIndex(2 * cell + offset);
+            uint8_t node_info = indirect_texture[index + 3];
+
+            if (node_info == INDIRECT_LEAF)
+            {
+                setHit(ray, cell, loc, real_child, c0, hit);
+                return true;
+            }
+            if (node_info != INDIRECT_EMPTY)
+            {
+                glm::ivec3 child_cell{ indirect_texture[index + 0],
+                                       indirect_texture[index + 1],
+                                       indirect_texture[index + 2] };
+                if (raycastNode(ray, child_cell, (loc << 3) | real_child, c0,
+                                c1, hit))
+                {
+                    return true;
+                }
+            }
+        }
+
+        // step to the neighbor across the closest exit plane
+        int axis = c1.x < c1.y ? (c1.x < c1.z ? 0 : 2) : (c1.y < c1.z ? 1 : 2);
+        if (child & (1 << axis))
+        {
+            return false;
+        }
+        child |= 1 << axis;
+    }
+}
+
+#ifdef __AVX2__
+// 8 rays with the same direction signs. Visiting the children in mirrored
+// index order is front to back for all of them, so the first leaf a lane
+// enters is its closest hit.
+struct VoxelOctree::PacketTraversal
+{
+    VoxelOctree& octree;
+    const RayState* rays;
+    RayHit* hits;
+    __m256 max_t;
+    uint8_t mirror;
+    // lanes that have hit something
+    int done;
+
+    void traverse(glm::ivec3 cell, LocCode loc, int active, const __m256 t0[3],
+                  const __m256 t1[3])
+    {
+        __m256 half = _mm256_set1_ps(0.5f);
+        __m256 tm[3];
+        for (int j = 0; j < 3; j++)
+            tm[j] = _mm256_mul_ps(half, _mm256_add_ps(t0[j], t1[j]));
+
+        for (int child = 0; child < 8; child++)
+        {
+            __m256 c0[3], c1[3];
+            for (int j = 0; j < 3; j++)
+            {
+                bool upper = child & (1 << j);
+                c0[j] = upper ? tm[j] : t0[j];
+                c1[j] = upper ? t1[j] : tm[j];
+            }
+            __m256 c_enter = _mm256_max_ps(c0[0], _mm256_max_ps(c0[1], c0[2]));
+            __m256 c_exit = _mm256_min_ps(c1[0], _mm256_min_ps(c1[1], c1[2]));
+
+            __m256 inside = _mm256_and_ps(
+                _mm256_cmp_ps(c_enter, c_exit, _CMP_LT_OQ),
+                _mm256_cmp_ps(c_exit, _mm256_setzero_ps(), _CMP_GE_OQ));
+            inside = _mm256_and_ps(
+                inside, _mm256_cmp_ps(c_enter, max_t, _CMP_LE_OQ));
+            int lanes = _mm256_movemask_ps(inside) & active & ~done;
+            if (lanes == 0) continue;
+
+            uint8_t real_child = child ^ mirror;
+            glm::ivec3 offset{ real_child & 1, (real_child >> 1) & 1,
+                               (real_child >> 2) & 1 };
+            size_t index = octree.textureIndex(2 * cell + offset);
+            uint8_t node_info = octree.indirect_texture[index + 3];
+            if (node_info == INDIRECT_EMPTY) continue;
+
+            alignas(32) float c0_lanes[3][8], c1_lanes[3][8];
+            for (int j = 0; j < 3; j++)
+            {
+                _mm256_store_ps(c0_lanes[j], c0[j]);
+                _mm256_store_ps(c1_lanes[j], c1[j]);
+            }
+            auto laneVec = [](float lanes[3][8], int lane) {
+                return glm::vec3(lanes[0][lane], lanes[1][lane],
+                                 lanes[2][lane]);
+            };
+
+            if (node_info == INDIRECT_LEAF)
+            {
+                for (int lane = 0; lane < 8; lane++)
+                {
+                    if ((lanes & (1 << lane)) == 0) continue;
+                    octree.setHit(rays[lane], cell, loc, real_child,
+                                  laneVec(c0_lanes, lane), hits[lane]);
+                }
+                done |= lanes;
+            }
+            else
+            {
+                glm::ivec3 child_cell{ octree.indirect_texture[index + 0],
+                                       octree.indirect_texture[index + 1],
+                                       octree.indirect_texture[index + 2] };
+                LocCode child_loc = (loc << 3) | real_child;
+
+                if (std::bitset<8>(lanes).count() == 1)
+                {
+                    // the packet has diverged, continue as a single ray
+                    int lane = 0;
+                    while ((lanes & (1 << lane)) == 0)
+                        lane++;
+                    if (octree.raycastNode(rays[lane], child_cell, child_loc,
+                                           laneVec(c0_lanes, lane),
+                                           laneVec(c1_lanes, lane),
+                                           hits[lane]))
+                    {
+                        done |= lanes;
+                    }
+                }
+                else
+                {
+                    traverse(child_cell, child_loc, lanes, c0, c1);
+                }
+            }
+
+            if ((active & ~done) == 0) return;
+        }
+    }
+};
+#endif
+
+void VoxelOctree::raycastPacket(const Ray* rays, int count, float max_t,
+                                RayHit* hits)
+{
+#ifdef __AVX2__
+    RayState states[8];
+    alignas(32) float t0_lanes[3][8] = {}, t1_lanes[3][8] = {};
+    int pending = 0;
+    for (int lane = 0; lane < count; lane++)
+    {
+        hits[lane] = RayHit();
+        glm::vec3 t0, t1;
+        if (initRay(rays[lane].origin, rays[lane].dir, max_t, states[lane], t0,
+                    t1))
+        {
+            pending |= 1 << lane;
+        }
+        for (int j = 0; j < 3; j++)
+        {
+            t0_lanes[j][lane] = t0[j];
+            t1_lanes[j][lane] = t1[j];
+        }
+    }
+
+    __m256 t0[3], t1[3];
+    for (int j = 0; j < 3; j++)
+    {
+        t0[j] = _mm256_load_ps(t0_lanes[j]);
+        t1[j] = _mm256_load_ps(t1_lanes[j]);
+    }
+
+    // one packet per set of direction signs
+    while (pending)
+    {
+        int first = 0;
+        while ((pending & (1 << first)) == 0)
+            first++;
+
+        int active = 0;
+        for (int lane = first; lane < count; lane++)
+        {
+            if ((pending & (1 << lane)) &&
+                states[lane].mirror == states[first].mirror)
+            {
+                active |= 1 << lane;
+            }
+        }
+        pending &= ~active;
+
+        PacketTraversal packet{ *this, states, hits, _mm256_set1_ps(max_t),
+                                states[first].mirror, 0 };
+        packet.traverse(glm::ivec3(0), 1, active, t0, t1);
+    }
+#else
+    for (int lane = 0; lane < count; lane++)
+        hits[lane] = raycast(rays[lane].origin, rays[lane].dir, max_t);
+#endif
+}
+
+void VoxelOctree::raycastPackets(const Ray* rays, size_t count, float max_t,
+                                 RayHit* hits)
+{
+    size_t num_packets = (count + 7) / 8;
+    size_t num_tasks = glm::max(1U, std::thread::hardware_concurrency());
+    size_t chunk = (num_packets + num_tasks - 1) / num_tasks;
+
+    std::vector<std::future<void>> futures;
+    for (size_t begin = 0; begin < num_packets; begin += chunk)
+    {
+        size_t end = glm::min(num_packets, begin + chunk);
+        futures.push_back(std::async(std::launch::async, [=]() {
+            for (size_t i = begin; i < end; i++)
+            {
+                int lanes = int(glm::min<size_t>(8, count - 8 * i));
+                raycastPacket(rays + 8 * i, lanes, max_t, hits + 8 * i);
+            }
+        }));
+    }
+    for (auto& future : futures)
+        future.wait();
+}
+
+void VoxelOctree::raycast(const Ray* rays, size_t count, float max_t,
+                          RayHit* hits)
+{
+    size_t num_tasks = glm::max(1U, std::thread::hardware_concurrency());
+    size_t chunk = (count + num_tasks - 1) / num_tasks;
+
+    std::vector<std::future<void>> futures;
+    for (size_t begin = 0; begin < count; begin += chunk)
+    {
+        size_t end = glm::min(count, begin + chunk);
+        futures.push_back(std::async(std::launch::async, [=]() {
+            for (size_t i = begin; i < end; i++)
+                hits[i] = raycast(rays[i].origin, rays[i].dir, max_t);
+        }));
+    }
+    for (auto& future : futures)
+        future.wait();
+}
+
+std::vector<RayHit> VoxelOctree::raycast(const std::vector<Ray>& rays,
+                                         float max_t)
+{
+    std::vector<RayHit> hits(rays.size());
+    raycast(rays.data(), rays.size(), max_t, hits.data());
+    return hits;
+}
+
+glm::vec3 VoxelOctree::calcPos(LocCode loc_code)
 {
     float offset = 0.5f;
     glm::vec3 result{ 0 };
-    for (int i = MAX_DEPTH - 1; i >= 0; i--)
+    for (int i = max_depth - 1; i >= 0; i--)
     {
-        uint32_t curr_loc = loc_code >> (i * 3);
+        LocCode curr_loc = loc_code >> (i * 3);
 
         // can probably be a for-loop
         if (curr_loc & 1)
@@ -167,21 +728,106 @@ glm::vec3 VoxelOctree::calcPos(uint32_t loc_code)
     return result;
 }
 
-bool VoxelOctree::noise(glm::vec3 pos) { return glm::perlin(2.f * pos, glm::vec3(4.f)) > 0.3; }
+bool VoxelOctree::noise(glm::vec3 pos)
+{
+    return glm::perlin(2.f * pos + noise_offset, glm::vec3(4.f)) >
+           noise_threshold;
+}
 
-VoxelOctree::VoxelOctree()
+VoxelOctree::VoxelOctree() : VoxelOctree(DEFAULT_DEPTH, 0.3f) {}
+
+VoxelOctree::VoxelOctree(uint8_t depth, float noise_threshold, uint32_t seed)
+    : noise_threshold(noise_threshold)
 {
+    if (seed != 0)
+    {
+        // Any offset within the noise period of 4 keeps the scene tileable.
+        // mt19937 output is fixed by the standard, distributions are not.
+        std::mt19937 rng(seed);
+        auto offset = [&]() { return float(rng() % 4096) / 1024.f; };
+        noise_offset.x = offset();
+        noise_offset.y = offset();
+        noise_offset.z = offset();
+    }
+
+    if (depth == 0 || depth > MAX_SUPPORTED_DEPTH)
+    {
+        THROW_RUNTIME_ERROR("Unsupported octree depth: " +
+                            std::to_string(depth));
+    }
+    max_depth = depth;
+
+    PROFILE_SCOPE("VoxelOctree()");
+
+    Timer timer;
     startGeneration();
+    build_times.build_seconds = timer.Restart();
+
+    createIndirectTexture();
+    build_times.texture_seconds = timer.Restart();
+}
+
+VoxelOctree::VoxelOctree(const std::vector<glm::uvec3>& voxels, uint8_t depth)
+{
+    if (depth == 0 || depth > MAX_SUPPORTED_DEPTH)
+    {
+        THROW_RUNTIME_ERROR("Unsupported octree depth: " +
+                            std::to_string(depth));
+    }
+    max_depth = depth;
+
+    PROFILE_SCOPE("VoxelOctree(voxels)");
+
+    Timer timer;
+    buildFromVoxels(voxels);
+    build_times.build_seconds = timer.Restart();
 
     createIndirectTexture();
+    build_times.texture_seconds = timer.Restart();
+}
+
+bool VoxelOctree::sameNodes(const VoxelOctree& other) const
+{
+    if (nodes.size() != other.nodes.size()) return false;
+    for (auto& [loc, node] : nodes)
+    {
+        auto iter = other.nodes.find(loc);
+        if (iter == other.nodes.end() ||
+            iter->second.child_exits != node.child_exits)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+LocCode VoxelOctree::locCodeFromCell(glm::uvec3 cell, uint8_t depth)
+{
+    LocCode loc = 1;
+    for (int bit = depth - 1; bit >= 0; bit--)
+    {
+        LocCode child_loc = ((cell.x >> bit) & 1) |
+                            (((cell.y >> bit) & 1) << 1) |
+                            (((cell.z >> bit) & 1) << 2);
+        loc = (loc << 3) | child_loc;
+    }
+    return loc;
 }
 
 void VoxelOctree::createIndirectTexture()
 {
+    PROFILE_SCOPE("createIndirectTexture");
+
     // TODO: some leaf nodes dont exist in nodes but need to exist in indirect texture
     // therefore 2*
     size_t side_len = glm::ceil(2 * glm::pow(double(nodes.size()), 1.0 / 3.0));
-    std::cout << side_len << "\n";
+
+    // cells are addressed with one byte per axis
+    if (side_len > 256)
+    {
+        THROW_RUNTIME_ERROR("Octree too large for indirect texture, " +
+                            std::to_string(nodes.size()) + " nodes");
+    }
 
     indirect_texture.resize(side_len * side_len * side_len * 8 * 4,
                             INDIRECT_EMPTY);
@@ -192,14 +838,14 @@ void VoxelOctree::createIndirectTexture()
     recursiveCreateIndirect(glm::ivec3(0), 1, 0);
 }
 
-void VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell, LocCode my_loc,
-                                          uint8_t depth)
+float VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell,
+                                           LocCode my_loc, uint8_t depth)
 {
     glm::ivec3 child_cells_start = next_free_cell;
 
     auto curr_iter = nodes.find(my_loc);
     if (curr_iter == nodes.end() ||
-        (curr_iter->second.child_exits == 255 && depth >= MAX_DEPTH))
+        (curr_iter->second.child_exits == 255 && depth >= max_depth))
     {
         // this is leaf node
 
@@ -216,11 +862,11 @@ void VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell, LocCode my_loc,
             indirect_texture[index + 2] = 0;
             indirect_texture[index + 3] = INDIRECT_LEAF;
         }
-        return;
+        return 1.f;
     }
-	if (depth > MAX_DEPTH)
+	if (depth > max_depth)
 	{
-		return;
+		return 0.f;
 	}
 
     Node node = curr_iter->second;
@@ -243,7 +889,8 @@ void VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell, LocCode my_loc,
             indirect_texture[index + 0] = indirect.x;
             indirect_texture[index + 1] = indirect.y;
             indirect_texture[index + 2] = indirect.z;
-            indirect_texture[index + 3] = INDIRECT_NODE;
+            // the occupancy is known once the child is built
+            indirect_texture[index + 3] = INDIRECT_NODE_MAX;
 
             // "reserve" the current next_free_cell for this child
             next_free_cell = nextCell(next_free_cell);
@@ -257,6 +904,7 @@ void VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell, LocCode my_loc,
         }
     }
 
+    float occupancy = 0.f;
     glm::ivec3 child_cell = child_cells_start;
     for (int i = 0; i < 8; i++)
     {
@@ -264,17 +912,24 @@ void VoxelOctree::recursiveCreateIndirect(glm::ivec3 my_cell, LocCode my_loc,
         if (child_bit & node.child_exits)
         {
             LocCode child_loc = (my_loc << 3) | i;
-            recursiveCreateIndirect(child_cell, child_loc, depth + 1);
+            float child_occupancy =
+                recursiveCreateIndirect(child_cell, child_loc, depth + 1);
+            occupancy += child_occupancy;
+
+            glm::ivec3 offset{ i & 1, (i >> 1) & 1, (i >> 2) & 1 };
+            indirect_texture[textureIndex(2 * my_cell + offset) + 3] =
+                uint8_t(INDIRECT_NODE_MIN +
+                        glm::round(child_occupancy * (INDIRECT_NODE_MAX -
+                                                      INDIRECT_NODE_MIN)));
 
             child_cell = nextCell(child_cell);
         }
     }
+    return occupancy / 8.f;
 }
 
-void VoxelOctree::printInfo()
+void VoxelOctree::printInfo(std::ostream& out)
 {
-    long size = (sizeof(Node) + sizeof(LocCode)) * nodes.size();
-
     long nv = 0;
     long nc = 0;
     for (int i = 0; i < 8; i++)
@@ -283,17 +938,70 @@ void VoxelOctree::printInfo()
         nc += num_checked[i];
     }
 
-    std::cout << "num checked:  " << nc << "\n\n";
+    // nodes per level and the texture cells holding their children, a
+    // node at level d with n children takes n cells at level d + 1
+    std::vector<size_t> level_nodes(max_depth + 1, 0);
+    std::vector<size_t> level_cells(max_depth + 2, 0);
+    level_cells[0] = 1;
+    for (auto& entry : nodes)
+    {
+        int level = 0;
+        for (LocCode loc = entry.first; loc > 1; loc >>= 3)
+            level++;
+        level_nodes[level]++;
+        level_cells[level + 1] +=
+            std::bitset<8>(entry.second.child_exits).count();
+    }
 
-    std::cout << "num voxels: " << nv << "\n";
-    std::cout << "num nodes:  " << nodes.size() << "\n";
-    std::cout << "num bits:   " << 8 * size << "\n";
-    std::cout << "bits/Voxel: " << 8.0 * size / double(nv) << "\n\n";
+    // every map node is allocated on its own and has the same size, the
+    // rest of the map's bytes are its bucket array
+    const memory::Counters& nodes_memory =
+        memory_usage[int(MemoryCategory::Nodes)];
+    memory::Usage nodes_usage = nodes_memory.usage();
+    size_t bytes_per_node =
+        nodes.empty() ? 0 : nodes_memory.singleLive() / nodes.size();
+    size_t cell_bytes = 8 * 4;
+
+    out << "{\n";
+    out << "  \"depth\": " << int(max_depth) << ",\n";
+    out << "  \"num_checked\": " << nc << ",\n";
+    out << "  \"num_voxels\": " << nv << ",\n";
+    out << "  \"num_nodes\": " << nodes.size() << ",\n";
+    out << "  \"node_buckets\": " << nodes.bucket_count() << ",\n";
+    out << "  \"bits_per_voxel\": "
+        << (nv ? 8.0 * nodes_usage.live / double(nv) : 0.0) << ",\n";
+    out << "  \"texture_side\": " << tex_side_length << ",\n";
+    out << "  \"bytes_per_node\": " << bytes_per_node << ",\n";
+    out << "  \"bucket_bytes\": "
+        << nodes_usage.live - nodes_memory.singleLive() << ",\n";
+
+    out << "  \"memory\": {\n";
+    const MemoryCategory categories[] = { MemoryCategory::GenMaps,
+                                          MemoryCategory::Nodes,
+                                          MemoryCategory::IndirectTexture };
+    for (auto category : categories)
+    {
+        memory::Usage usage = memory_usage[int(category)].usage();
+        out << "    \"" << memory::categoryName(category)
+            << "\": {\"live_bytes\": " << usage.live
+            << ", \"peak_bytes\": " << usage.peak
+            << ", \"allocations\": " << usage.allocations << "}"
+            << (category != MemoryCategory::IndirectTexture ? ",\n" : "\n");
+    }
+    out << "  },\n";
 
-    std::cout << size << " Bytes\n";
-    std::cout << size / 1024U << " KB\n";
-    std::cout << size / 1048576U << " MB\n";
-    std::cout << size / 1073741824U << " GB\n";
+    out << "  \"levels\": [\n";
+    for (int level = 0; level <= max_depth; level++)
+    {
+        out << "    {\"level\": " << level
+            << ", \"nodes\": " << level_nodes[level] << ", \"node_bytes\": "
+            << level_nodes[level] * bytes_per_node
+            << ", \"texture_cells\": " << level_cells[level]
+            << ", \"texture_bytes\": " << level_cells[level] * cell_bytes
+            << "}" << (level < max_depth ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
 }
 
 uint8_t VoxelOctree::recursiveGenerate(uint8_t curr_child, LocCode loc_code,
@@ -302,7 +1010,7 @@ uint8_t VoxelOctree::recursiveGenerate(uint8_t curr_child, LocCode loc_code,
     LocCode curr_loc_code = curr_child;
     LocCode total_loc_code = (loc_code << 3) | curr_loc_code;
 
-    if (depth >= MAX_DEPTH)
+    if (depth >= max_depth)
     {
         num_checked[map_index]++;
 
@@ -381,10 +1089,17 @@ void VoxelOctree::startGeneration()
 
     std::vector<std::future<uint8_t>> futures;
 
+    NodeMap<MemoryCategory::GenMaps>::allocator_type gen_allocator(
+        &memory_usage[int(MemoryCategory::GenMaps)]);
+    for (auto& map : gen_maps)
+        map = NodeMap<MemoryCategory::GenMaps>(gen_allocator);
+
     for (int i = 0; i < 8; i++)
     {
-        futures.push_back(std::async(&VoxelOctree::recursiveGenerate, this, i,
-                                     total_loc_code, depth + 1, i));
+        futures.push_back(std::async([=]() {
+            PROFILE_SCOPE("generate octant");
+            return recursiveGenerate(i, total_loc_code, depth + 1, i);
+        }));
     }
 
     for (int i = 0; i < 8; i++)
@@ -402,7 +1117,8 @@ void VoxelOctree::startGeneration()
         }
 
         nodes.insert(gen_maps[i].begin(), gen_maps[i].end());
-        gen_maps[i].clear();
+        // clear() keeps the bucket array, swapping releases it
+        NodeMap<MemoryCategory::GenMaps>(gen_allocator).swap(gen_maps[i]);
     }
 
     if (child_exits)
@@ -423,3 +1139,109 @@ void VoxelOctree::startGeneration()
         nodes[total_loc_code] = { child_exits };
     }
 }
+
+std::vector<LocCode>
+VoxelOctree::sortedLocCodes(const std::vector<glm::uvec3>& voxels)
+{
+    const LocCode side = LocCode(1) << max_depth;
+
+    // bucket by root octant, same split as startGeneration
+    std::vector<LocCode> buckets[8];
+    const int octant_shift = 3 * (max_depth - 1);
+    for (auto& voxel : voxels)
+    {
+        if (voxel.x >= side || voxel.y >= side || voxel.z >= side)
+        {
+            continue;
+        }
+        LocCode loc = locCodeFromCell(voxel, max_depth);
+        buckets[(loc >> octant_shift) & 7].push_back(loc);
+    }
+
+    // LSD radix sort of the remaining bits, 8 bits per pass, one task per
+    // octant
+    auto radix_sort = [octant_shift](std::vector<LocCode>* bucket) {
+        PROFILE_SCOPE("sort octant");
+        std::vector<LocCode> temp(bucket->size());
+        for (int shift = 0; shift < octant_shift; shift += 8)
+        {
+            size_t counts[257] = {};
+            for (LocCode loc : *bucket)
+                counts[((loc >> shift) & 255) + 1]++;
+            for (int i = 0; i < 256; i++)
+                counts[i + 1] += counts[i];
+            for (LocCode loc : *bucket)
+                temp[counts[(loc >> shift) & 255]++] = loc;
+            bucket->swap(temp);
+        }
+        bucket->erase(std::unique(bucket->begin(), bucket->end()),
+                      bucket->end());
+    };
+
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < 8; i++)
+    {
+        futures.push_back(std::async(std::launch::async, radix_sort,
+                                     &buckets[i]));
+    }
+
+    std::vector<LocCode> result;
+    for (int i = 0; i < 8; i++)
+    {
+        futures[i].wait();
+        result.insert(result.end(), buckets[i].begin(), buckets[i].end());
+        std::vector<LocCode>().swap(buckets[i]);
+    }
+    return result;
+}
+
+void VoxelOctree::buildFromVoxels(const std::vector<glm::uvec3>& voxels)
+{
+    PROFILE_SCOPE("buildFromVoxels");
+
+    std::vector<LocCode> level = sortedLocCodes(voxels);
+    // voxels at max_depth are always full
+    std::vector<bool> level_full(level.size(), true);
+
+    num_voxels[0] = level.size();
+    num_checked[0] = level.size();
+
+    std::vector<std::pair<LocCode, Node>> created;
+
+    // siblings are adjacent after sorting, so each level is one linear pass
+    // over the level below. Full nodes are left out like in checkChildren.
+    for (int depth = max_depth; depth > 0; depth--)
+    {
+        std::vector<LocCode> parents;
+        std::vector<bool> parents_full;
+
+        size_t i = 0;
+        while (i < level.size())
+        {
+            LocCode parent_loc = level[i] >> 3;
+
+            uint8_t child_exits = 0;
+            bool children_full = true;
+            for (; i < level.size() && (level[i] >> 3) == parent_loc; i++)
+            {
+                child_exits |= 1 << (level[i] & 7);
+                children_full = children_full && level_full[i];
+            }
+
+            bool full = children_full && child_exits == 255;
+            if (!full || parent_loc == 1)
+            {
+                created.push_back({ parent_loc, { child_exits } });
+            }
+            parents.push_back(parent_loc);
+            parents_full.push_back(full);
+        }
+
+        level.swap(parents);
+        level_full.swap(parents_full);
+    }
+
+    nodes.clear();
+    nodes.reserve(created.size());
+    nodes.insert(created.begin(), created.end());
+}
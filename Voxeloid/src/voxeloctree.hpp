@@ -1,21 +1,129 @@
 #pragma once
 
+#include "util/memorytracker.hpp"
+
 #include <cstdint>
 #include <glm/glm.hpp>
+#include <iostream>
 #include <unordered_map>
+#include <vector>
 
 typedef uint64_t LocCode;
 
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 dir;
+};
+
+struct RayHit
+{
+    bool hit = false;
+    float t = 0.f;
+    glm::vec3 position{ 0 };
+    // zero when the origin is inside the hit voxel
+    glm::vec3 normal{ 0 };
+    // the largest solid node containing the hit
+    LocCode loc = 0;
+};
+
 class VoxelOctree
 {
   public:
     VoxelOctree();
+    // Noise scene, voxels where the noise is above the threshold. Other
+    // seeds shift the noise, seed 0 is the default scene.
+    VoxelOctree(uint8_t depth, float noise_threshold, uint32_t seed = 0);
+    // voxels are cell coordinates in [0, 2^depth), duplicates are allowed
+    VoxelOctree(const std::vector<glm::uvec3>& voxels, uint8_t depth);
+
+    using IndirectTexture =
+        std::vector<uint8_t,
+                    TrackingAllocator<uint8_t, MemoryCategory::IndirectTexture>>;
+
+    // JSON with node and voxel counts, the tracked bytes of this octree's
+    // containers and nodes and texture cells per tree level
+    void printInfo(std::ostream& out = std::cout);
 
-    void printInfo();
 
+    struct BuildTimes
+    {
+        // startGeneration or buildFromVoxels
+        double build_seconds = 0;
+        double texture_seconds = 0;
+    };
+    const BuildTimes& getBuildTimes() const { return build_times; }
 
 	size_t getIndirectSize() { return tex_side_length; }
-	std::vector<uint8_t>& getIndirectTexture() { return indirect_texture; }
+	IndirectTexture& getIndirectTexture() { return indirect_texture; }
+
+    uint8_t getDepth() { return max_depth; }
+
+    // true if both octrees have the same nodes with the same children
+    bool sameNodes(const VoxelOctree& other) const;
+
+    // LocCodes fit 21 levels (3 * 21 bits + the sentinel bit)
+    constexpr static uint8_t MAX_SUPPORTED_DEPTH = 21;
+
+    static LocCode locCodeFromCell(glm::uvec3 cell, uint8_t depth);
+    // center of the node in [-1, 1]
+    glm::vec3 calcPos(LocCode loc_code);
+
+    // pos in [-1, 1], isVoxel uses the nodes map, isVoxel2 the indirect texture
+    bool isVoxel(glm::vec3 pos);
+    bool isVoxel2(glm::vec3 pos);
+
+    // Same result as isVoxel2 for count positions, bit i % 64 of
+    // result[i / 64] is set if positions[i] is inside a voxel.
+    // Descends 8 positions at a time level by level when built with AVX2.
+    void isVoxelBatch(const glm::vec3* positions, size_t count,
+                      uint64_t* result);
+    std::vector<uint64_t> isVoxelBatch(const std::vector<glm::vec3>& positions);
+
+    // First voxel along the ray in [0, max_t], dir does not need to be
+    // normalized. Walks the indirect texture like shader.frag, visiting
+    // children front to back in the order given by the signs of dir.
+    // Positions are in octree space [-1, 1], shader.frag draws the octree in
+    // the unit cube [0, 1] repeated along every axis.
+    RayHit raycast(glm::vec3 origin, glm::vec3 dir, float max_t);
+    // Splits the rays over all hardware threads
+    void raycast(const Ray* rays, size_t count, float max_t, RayHit* hits);
+    std::vector<RayHit> raycast(const std::vector<Ray>& rays, float max_t);
+    // Same hits as raycast, for coherent bundles such as camera tiles or
+    // shadow rays toward one light. Each run of 8 rays is traced as a packet
+    // with AVX2, split by direction signs and into single rays where only
+    // one ray of the packet enters a node.
+    void raycastPackets(const Ray* rays, size_t count, float max_t,
+                        RayHit* hits);
+
+    // Same result as isVoxel, but keeps the node lookups of the last query.
+    // A query only repeats the lookups below the lowest common ancestor of
+    // the two positions, so nearby queries in sequence are cheap.
+    class Cursor
+    {
+      public:
+        Cursor(VoxelOctree& octree) : octree(octree) {}
+
+        bool isVoxel(glm::vec3 pos);
+
+      private:
+        struct Level
+        {
+            LocCode loc = 0;
+            bool found = false;
+            uint8_t child_exits = 0;
+        };
+
+        VoxelOctree& octree;
+
+        // finest cell of the last position
+        glm::ivec3 last_cell_pos{ 0 };
+        // levels [0, num_cached) hold the LocCodes and node lookups on the
+        // path to last_cell_pos, level i is selected by the bits of the cell
+        // above bit max_depth - i
+        int num_cached = 0;
+        Level levels[MAX_SUPPORTED_DEPTH + 1];
+    };
 
   private:
     // https://geidav.wordpress.com/2014/08/18/advanced-octrees-2-node-representations/
@@ -25,11 +133,21 @@ class VoxelOctree
         //uint32_t loc_code;
     };
 
-    const static uint8_t MAX_DEPTH = 5;
+    template <MemoryCategory C>
+    using NodeMap =
+        std::unordered_map<LocCode, Node, std::hash<LocCode>,
+                           std::equal_to<LocCode>,
+                           TrackingAllocator<std::pair<const LocCode, Node>, C>>;
+
+    constexpr static uint8_t DEFAULT_DEPTH = 5;
 
-    const static uint8_t INDIRECT_LEAF = 255;
-    const static uint8_t INDIRECT_EMPTY = 0;
-    const static uint8_t INDIRECT_NODE = 127;
+    constexpr static uint8_t INDIRECT_LEAF = 255;
+    constexpr static uint8_t INDIRECT_EMPTY = 0;
+    // Any other value is a node, scaled from INDIRECT_NODE_MIN to
+    // INDIRECT_NODE_MAX by the solid fraction of its volume. Traversals
+    // that stop above the finest level judge the node by it.
+    constexpr static uint8_t INDIRECT_NODE_MIN = 1;
+    constexpr static uint8_t INDIRECT_NODE_MAX = 254;
 
     //  first bit (1) = some grandchild has voxel
     // second bit (2) = some grandchild has empty space
@@ -39,33 +157,68 @@ class VoxelOctree
                           uint8_t map_index);
     void startGeneration();
 
-    glm::vec3 calcPos(uint32_t loc_code);
+    // sorts the leaf LocCodes and builds the nodes bottom-up in one pass
+    void buildFromVoxels(const std::vector<glm::uvec3>& voxels);
+    std::vector<LocCode> sortedLocCodes(const std::vector<glm::uvec3>& voxels);
 
     void createIndirectTexture();
-    void recursiveCreateIndirect(glm::ivec3 my_cell, LocCode parent_loc,
-                                 uint8_t depth);
+    // returns the solid fraction of the node's volume
+    float recursiveCreateIndirect(glm::ivec3 my_cell, LocCode parent_loc,
+                                  uint8_t depth);
 
     size_t textureIndex(glm::ivec3 cell);
     glm::ivec3 nextCell(glm::ivec3 i, int offset = 1);
     glm::ivec3 nextCellNoWrap(glm::ivec3 i, int offset = 1);
 
-    bool isVoxel(glm::vec3 pos);
-    bool isVoxel2(glm::vec3 pos);
+    uint8_t isVoxel8(const glm::vec3* positions, int count);
+
+    struct RayState
+    {
+        glm::vec3 origin;
+        glm::vec3 dir;
+        float max_t;
+        // axes where dir is negative, the traversal runs mirrored along them
+        uint8_t mirror;
+    };
+    // sets up the root slabs, false if the ray misses the octree
+    static bool initRay(glm::vec3 origin, glm::vec3 dir, float max_t,
+                        RayState& ray, glm::vec3& t0, glm::vec3& t1);
+    // t0 and t1 are the slab entry and exit of the node, mirrored
+    bool raycastNode(const RayState& ray, glm::ivec3 cell, LocCode loc,
+                     glm::vec3 t0, glm::vec3 t1, RayHit& hit);
+    // c0 is the slab entry of the leaf child of cell that was hit
+    void setHit(const RayState& ray, glm::ivec3 cell, LocCode loc,
+                uint8_t child, glm::vec3 c0, RayHit& hit);
+
+    struct PacketTraversal;
+    void raycastPacket(const Ray* rays, int count, float max_t, RayHit* hits);
 
     bool noise(glm::vec3 pos);
 
 
-    Node root;
-    std::unordered_map<LocCode, Node> gen_maps[8];
+    uint8_t max_depth = DEFAULT_DEPTH;
+    float noise_threshold = 0.3f;
+    glm::vec3 noise_offset{ 0 };
+    BuildTimes build_times;
 
-    std::unordered_map<LocCode, Node> nodes;
+    Node root;
+    // bytes of this octree's containers, declared before them
+    memory::Counters memory_usage[int(MemoryCategory::Count)];
+    // startGeneration points them at memory_usage
+    NodeMap<MemoryCategory::GenMaps> gen_maps[8];
+
+    NodeMap<MemoryCategory::Nodes> nodes{
+        NodeMap<MemoryCategory::Nodes>::allocator_type(
+            &memory_usage[int(MemoryCategory::Nodes)])
+    };
 
-    std::vector<uint8_t> indirect_texture;
+    IndirectTexture indirect_texture{ IndirectTexture::allocator_type(
+        &memory_usage[int(MemoryCategory::IndirectTexture)]) };
     size_t tex_side_length = 0;
     size_t cells_side_length = 0;
 
     glm::ivec3 next_free_cell{ 0 };
 
-    long num_voxels[8];
-    long num_checked[8];
-};
\ No newline at end of file
+    long num_voxels[8] = {};
+    long num_checked[8] = {};
+};